@@ -0,0 +1,125 @@
+// Source code for Test task
+// Licensed after GNU GPL v3
+
+#include "ans.h"
+#include <cmath>
+#include <numeric>
+#include <stdexcept>
+
+namespace HuffmanTree
+{
+
+AnsTable::AnsTable(const HTDistionary& dictionary, const HTFrequency& frequency)
+{
+	if (!Fits(dictionary))
+		throw std::invalid_argument("Alphabet is too large for rANS");
+	size_t alphabet = dictionary.symbols.size();
+	std::vector<uint64_t> counts(alphabet, 0);
+	uint64_t total = 0;
+	for (const auto& symbol : frequency)
+	{
+		counts[dictionary.Code(symbol.value).index] = symbol.frequency;
+		total += symbol.frequency;
+	}
+
+	// Every symbol keeps at least one slot; the rounding error is settled
+	// on the most frequent symbols, where it costs the least
+	this->frequency.resize(alphabet);
+	int64_t assigned = 0;
+	for (size_t i = 0; i < alphabet; ++i)
+	{
+		double share = static_cast<double>(counts[i]) / static_cast<double>(total) * PROB_SCALE;
+		this->frequency[i] = static_cast<uint16_t>(std::clamp<double>(std::floor(share), 1, PROB_SCALE));
+		assigned += this->frequency[i];
+	}
+	std::vector<size_t> order(alphabet);
+	std::iota(order.begin(), order.end(), 0);
+	std::sort(order.begin(), order.end(), [&counts](size_t lhs, size_t rhs)
+	{
+		return counts[lhs] > counts[rhs];
+	});
+	int64_t excess = assigned - PROB_SCALE;
+	if (excess < 0)
+		this->frequency[order.front()] += static_cast<uint16_t>(-excess);
+	for (size_t k = 0; excess > 0 && k < alphabet; ++k)
+	{
+		auto& freq = this->frequency[order[k]];
+		int64_t take = std::min<int64_t>(excess, freq - 1);
+		freq -= static_cast<uint16_t>(take);
+		excess -= take;
+	}
+	Build(dictionary);
+}
+
+AnsTable::AnsTable(const HTDistionary& dictionary, std::vector<uint16_t> quantized)
+	: frequency{std::move(quantized)}
+{
+	uint64_t sum = 0;
+	for (auto freq : frequency)
+		sum += freq;
+	if (frequency.size() != dictionary.symbols.size() || sum != PROB_SCALE
+		|| std::find(frequency.cbegin(), frequency.cend(), 0) != frequency.cend())
+		throw std::invalid_argument("rANS frequencies do not match the dictionary");
+	Build(dictionary);
+}
+
+void AnsTable::Build(const HTDistionary& dictionary)
+{
+	size_t alphabet = frequency.size();
+	start.resize(alphabet);
+	cost.resize(alphabet);
+	slots.resize(PROB_SCALE);
+	uint32_t cumulative = 0;
+	for (size_t i = 0; i < alphabet; ++i)
+	{
+		start[i] = static_cast<uint16_t>(cumulative);
+		cost[i] = PROB_BITS - std::log2(static_cast<double>(frequency[i]));
+		for (uint32_t k = 0; k < frequency[i]; ++k)
+			slots[cumulative + k] = {dictionary.symbols[i], frequency[i], start[i]};
+		cumulative += frequency[i];
+	}
+}
+
+BitStream AnsTable::Pack(const std::vector<uint16_t>& units)
+{
+	constexpr size_t UNITS_PER_WORD = WORD_BITS / UNIT_BITS;
+	BitStream result;
+	result.bits = units.size() * UNIT_BITS;
+	result.words.assign(WordCount(result.bits), 0);
+	for (size_t k = 0; k < units.size(); ++k)
+		result.words[k / UNITS_PER_WORD] |= uint64_t{units[k]} << (k % UNITS_PER_WORD * UNIT_BITS);
+	return result;
+}
+
+void AnsTable::Decode(const uint64_t* words, size_t word_count, int* out, size_t count) const
+{
+	constexpr size_t UNITS_PER_WORD = WORD_BITS / UNIT_BITS;
+	size_t position = 0;
+	// past the block end reads zeros, so corrupted input cannot read out of bounds
+	auto read = [&]() -> uint32_t
+	{
+		size_t index = position / UNITS_PER_WORD;
+		uint64_t word = index < word_count ? words[index] : 0;
+		return static_cast<uint16_t>(word >> (position++ % UNITS_PER_WORD * UNIT_BITS));
+	};
+
+	uint32_t state[STATES];
+	for (auto& x : state)
+	{
+		x = read() << UNIT_BITS;
+		x |= read();
+	}
+	const Slot* table = slots.data();
+	for (size_t i = 0; i < count; ++i)
+	{
+		uint32_t& x = state[i % STATES];
+		uint32_t slot = x & (PROB_SCALE - 1);
+		const Slot& entry = table[slot];
+		out[i] = entry.value;
+		x = entry.freq * (x >> PROB_BITS) + slot - entry.start;
+		if (x < LOWER_BOUND)
+			x = (x << UNIT_BITS) | read();
+	}
+}
+
+}
@@ -0,0 +1,119 @@
+// Source code for Test task
+// Licensed after GNU GPL v3
+
+#ifndef ANS_H
+#define ANS_H
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include "huffmantree.h"
+
+namespace HuffmanTree
+{
+
+// Static rANS over the alphabet of a Huffman dictionary. Probabilities are
+// quantized to PROB_BITS and kept in the canonical order of the dictionary,
+// so a symbol is found through HuffmanCode::index. A block is coded with
+// STATES interleaved 32-bit states that are renormalized 16 bits at a time;
+// unlike Huffman codes a symbol may cost a fraction of a bit, which is where
+// near-constant data gains.
+class AnsTable
+{
+public:
+	static constexpr unsigned PROB_BITS = 14;
+	static constexpr uint32_t PROB_SCALE = uint32_t{1} << PROB_BITS;
+	static constexpr size_t MAX_ALPHABET = size_t{1} << 12;
+	static constexpr unsigned STATES = 4;
+	static constexpr unsigned UNIT_BITS = 16;
+	static constexpr uint32_t LOWER_BOUND = uint32_t{1} << 16;
+
+	AnsTable() = default;
+	// Quantizes the frequencies of the dictionary's symbols
+	AnsTable(const HTDistionary& dictionary, const HTFrequency& frequency);
+	// Quantized frequencies in canonical order, as stored in a file; they
+	// must sum to PROB_SCALE
+	AnsTable(const HTDistionary& dictionary, std::vector<uint16_t> quantized);
+
+	static bool Fits(const HTDistionary& dictionary)
+	{
+		return !dictionary.empty() && dictionary.symbols.size() <= MAX_ALPHABET;
+	}
+
+	bool empty() const
+	{
+		return frequency.empty();
+	}
+
+	const std::vector<uint16_t>& Frequencies() const
+	{
+		return frequency;
+	}
+
+	// Bits the symbol at index costs, fractional
+	double Cost(uint32_t index) const
+	{
+		return cost[index];
+	}
+
+	// Bits of the final states every block carries
+	static constexpr size_t FlushBits()
+	{
+		return STATES * 32;
+	}
+
+	// Codes count symbols from first, all of which must be in the dictionary
+	template<typename It>
+	BitStream Encode(It first, size_t count, const HTDistionary& dictionary) const
+	{
+		std::vector<uint16_t> units;
+		units.reserve(count / 4 + 2 * STATES);
+		uint32_t state[STATES];
+		std::fill(std::begin(state), std::end(state), LOWER_BOUND);
+		// rANS is last in, first out: encode backwards, reverse the units
+		for (size_t i = count; i-- > 0;)
+		{
+			uint32_t index = dictionary.Code(first[i]).index;
+			uint32_t freq = frequency[index];
+			uint32_t& x = state[i % STATES];
+			uint64_t x_max = uint64_t{(LOWER_BOUND >> PROB_BITS) << UNIT_BITS} * freq;
+			if (x >= x_max)
+			{
+				units.push_back(static_cast<uint16_t>(x));
+				x >>= UNIT_BITS;
+			}
+			x = ((x / freq) << PROB_BITS) + x % freq + start[index];
+		}
+		for (unsigned s = STATES; s-- > 0;)
+		{
+			units.push_back(static_cast<uint16_t>(state[s]));
+			units.push_back(static_cast<uint16_t>(state[s] >> UNIT_BITS));
+		}
+		std::reverse(units.begin(), units.end());
+		return Pack(units);
+	}
+
+	// Decodes count symbols of a block that starts at words and ends before
+	// words + word_count
+	void Decode(const uint64_t* words, size_t word_count, int* out, size_t count) const;
+
+private:
+	struct Slot
+	{
+		int value{0};
+		uint16_t freq{0};
+		uint16_t start{0};
+	};
+
+	std::vector<uint16_t> frequency;
+	std::vector<uint16_t> start;
+	std::vector<double> cost;
+	std::vector<Slot> slots;
+
+	void Build(const HTDistionary& dictionary);
+	static BitStream Pack(const std::vector<uint16_t>& units);
+};
+
+}
+
+#endif // ANS_H
@@ -0,0 +1,276 @@
+// Source code for Test task
+// Licensed after GNU GPL v3
+
+// Throughput benchmark of the compression stages. Sweeps distributions,
+// input sizes, thread counts and Huffman sub-streams per block and reports
+// MB/s of input per stage over repeated runs. With --csv the results go to
+// stdout as CSV, one row per (distribution, size, threads, streams, stage),
+// so that two builds can be diffed.
+//
+// Usage: data_compressor_bench [--csv] [--repeat N] [--sizes N,N,...] [--threads N,N,...]
+//                              [--streams N,N,...]
+
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+#include "blockcodec.h"
+
+using namespace HuffmanTree;
+
+namespace
+{
+struct Distribution
+{
+	const char* name;
+	std::function<std::vector<int>(size_t size)> generate;
+};
+
+std::vector<int> Uniform(int min, int max, size_t size)
+{
+	std::vector<int> result(size);
+	std::mt19937 gen(1);
+	std::uniform_int_distribution<> distrib(min, max);
+	for (auto& value : result)
+		value = distrib(gen);
+	return result;
+}
+
+// Rank r in [1, alphabet] drawn with probability proportional to 1 / r^s
+std::vector<int> Zipf(double s, int alphabet, size_t size)
+{
+	std::vector<double> cdf(alphabet);
+	double sum = 0;
+	for (int r = 0; r < alphabet; ++r)
+		cdf[r] = sum += 1.0 / std::pow(r + 1, s);
+	std::vector<int> result(size);
+	std::mt19937 gen(2);
+	std::uniform_real_distribution<> distrib(0, sum);
+	for (auto& value : result)
+		value = static_cast<int>(std::lower_bound(cdf.cbegin(), cdf.cend(), distrib(gen)) - cdf.cbegin()) + 1;
+	return result;
+}
+
+std::vector<int> Geometric(double p, size_t size)
+{
+	std::vector<int> result(size);
+	std::mt19937 gen(3);
+	std::geometric_distribution<> distrib(p);
+	for (auto& value : result)
+		value = distrib(gen);
+	return result;
+}
+
+// Uniform over an alphabet scattered across the whole int range, which
+// takes the hash map path of the frequency count
+std::vector<int> Sparse(size_t alphabet, size_t size)
+{
+	std::mt19937 gen(4);
+	std::uniform_int_distribution<> any(std::numeric_limits<int>::min(), std::numeric_limits<int>::max());
+	std::vector<int> values(alphabet);
+	for (auto& value : values)
+		value = any(gen);
+	std::vector<int> result(size);
+	std::uniform_int_distribution<size_t> pick(0, alphabet - 1);
+	for (auto& value : result)
+		value = values[pick(gen)];
+	return result;
+}
+
+// One value with a small share of uniform noise
+std::vector<int> NearConstant(double noise, size_t size)
+{
+	std::vector<int> result(size);
+	std::mt19937 gen(5);
+	std::bernoulli_distribution is_noise(noise);
+	std::uniform_int_distribution<> distrib(0, 255);
+	for (auto& value : result)
+		value = is_noise(gen) ? distrib(gen) : 7;
+	return result;
+}
+
+const std::vector<Distribution> DISTRIBUTIONS = {
+	{"uniform", [](size_t size) { return Uniform(1, 100, size); }},
+	{"zipf", [](size_t size) { return Zipf(1.1, 1 << 16, size); }},
+	{"geometric", [](size_t size) { return Geometric(0.2, size); }},
+	{"sparse", [](size_t size) { return Sparse(size_t{1} << 16, size); }},
+	{"near_constant", [](size_t size) { return NearConstant(0.01, size); }},
+};
+
+const char* const STAGES[] = {"frequency", "tree", "encode", "decode"};
+constexpr size_t NSTAGES = std::size(STAGES);
+
+struct Options
+{
+	bool csv{false};
+	size_t repeat{9};
+	std::vector<size_t> sizes{size_t{1} << 16, size_t{1} << 20, size_t{1} << 24};
+	std::vector<size_t> threads{1, HardwareThreads()};
+	std::vector<size_t> streams{1, 4};
+};
+
+std::vector<size_t> ParseList(const char* text)
+{
+	std::vector<size_t> result;
+	std::string item;
+	for (const char* c = text;; ++c)
+	{
+		if (*c == ',' || *c == '\0')
+		{
+			if (!item.empty())
+				result.push_back(std::stoull(item));
+			item.clear();
+			if (*c == '\0')
+				break;
+		}
+		else
+		{
+			item += *c;
+		}
+	}
+	return result;
+}
+
+bool ParseOptions(int argc, char* argv[], Options& options)
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		bool has_value = i + 1 < argc;
+		if (std::strcmp(argv[i], "--csv") == 0)
+			options.csv = true;
+		else if (std::strcmp(argv[i], "--repeat") == 0 && has_value)
+			options.repeat = std::max<size_t>(std::stoull(argv[++i]), 1);
+		else if (std::strcmp(argv[i], "--sizes") == 0 && has_value)
+			options.sizes = ParseList(argv[++i]);
+		else if (std::strcmp(argv[i], "--threads") == 0 && has_value)
+			options.threads = ParseList(argv[++i]);
+		else if (std::strcmp(argv[i], "--streams") == 0 && has_value)
+			options.streams = ParseList(argv[++i]);
+		else
+			return false;
+	}
+	options.threads.erase(std::unique(options.threads.begin(), options.threads.end()), options.threads.end());
+	bool valid_streams = std::all_of(options.streams.cbegin(), options.streams.cend(), [](size_t streams)
+	{
+		return ValidStreamCount(static_cast<unsigned>(streams));
+	});
+	return !options.sizes.empty() && !options.threads.empty() && !options.streams.empty() && valid_streams;
+}
+
+// Nearest-rank percentile of sorted values
+double Percentile(const std::vector<double>& sorted, double p)
+{
+	size_t rank = static_cast<size_t>(std::ceil(p / 100 * sorted.size()));
+	return sorted[std::clamp<size_t>(rank, 1, sorted.size()) - 1];
+}
+
+double Seconds(std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end)
+{
+	return std::chrono::duration<double>(end - start).count();
+}
+
+// Runs the stages repeat times after one warm-up run and returns the
+// seconds of every stage and run; fails if a round trip does not match
+bool RunStages(const std::vector<int>& sequence, ThreadPool& pool, unsigned streams, size_t repeat,
+			   std::vector<double> (&seconds)[NSTAGES])
+{
+	for (size_t run = 0; run <= repeat; ++run)
+	{
+		auto t0 = std::chrono::steady_clock::now();
+		auto frequency = MakeHuffmanFrequency(sequence.cbegin(), sequence.cend(), pool);
+		auto t1 = std::chrono::steady_clock::now();
+		auto dictionary = MakeHuffmanDictionary(frequency);
+		auto t2 = std::chrono::steady_clock::now();
+		BlockCoding coding{&dictionary, nullptr, streams};
+		auto blocks = CompressBlocks(sequence.cbegin(), BlockCounts(sequence.size(), DEFAULT_BLOCK_SIZE),
+									 coding, pool);
+		auto t3 = std::chrono::steady_clock::now();
+		auto decoded = DecompressBlocks(blocks, coding, pool);
+		auto t4 = std::chrono::steady_clock::now();
+
+		if (decoded != sequence)
+			return false;
+		if (run == 0)
+			continue;
+		seconds[0].push_back(Seconds(t0, t1));
+		seconds[1].push_back(Seconds(t1, t2));
+		seconds[2].push_back(Seconds(t2, t3));
+		seconds[3].push_back(Seconds(t3, t4));
+	}
+	return true;
+}
+}
+
+int main(int argc, char* argv[])
+{
+	Options options;
+	if (!ParseOptions(argc, argv, options))
+	{
+		std::cerr << "Usage: " << argv[0]
+				  << " [--csv] [--repeat N] [--sizes N,N,...] [--threads N,N,...] [--streams N,N,...]" << std::endl;
+		return 1;
+	}
+
+	if (options.csv)
+		std::cout << "distribution,size,threads,streams,stage,runs,mbps_p10,mbps_p50,mbps_p90,mbps_max"
+				  << std::endl;
+	else
+		std::cout << std::left << std::setw(14) << "distribution" << std::right << std::setw(10) << "size"
+				  << std::setw(8) << "threads" << std::setw(8) << "streams" << "  " << std::left << std::setw(10) << "stage" << std::right
+				  << std::setw(12) << "p10 MB/s" << std::setw(12) << "p50 MB/s" << std::setw(12) << "p90 MB/s"
+				  << std::endl;
+
+	bool all_ok = true;
+	for (const auto& distribution : DISTRIBUTIONS)
+	{
+		for (auto size : options.sizes)
+		{
+			auto sequence = distribution.generate(size);
+			double megabytes = size * sizeof(int) / 1e6;
+			for (auto nthreads : options.threads)
+			{
+				ThreadPool pool(nthreads);
+				for (auto streams : options.streams)
+				{
+					std::vector<double> seconds[NSTAGES];
+					if (!RunStages(sequence, pool, static_cast<unsigned>(streams), options.repeat, seconds))
+					{
+						std::cerr << distribution.name << " " << size << " " << nthreads << " " << streams
+								  << ": round trip is wrong" << std::endl;
+						all_ok = false;
+						continue;
+					}
+					for (size_t stage = 0; stage < NSTAGES; ++stage)
+					{
+						std::vector<double> mbps;
+						for (auto s : seconds[stage])
+							mbps.push_back(megabytes / std::max(s, 1e-9));
+						std::sort(mbps.begin(), mbps.end());
+						double p10 = Percentile(mbps, 10);
+						double p50 = Percentile(mbps, 50);
+						double p90 = Percentile(mbps, 90);
+						if (options.csv)
+							std::cout << distribution.name << ',' << size << ',' << nthreads << ',' << streams
+									  << ',' << STAGES[stage] << ',' << mbps.size() << ',' << p10 << ',' << p50
+									  << ',' << p90 << ',' << mbps.back() << std::endl;
+						else
+							std::cout << std::left << std::setw(14) << distribution.name << std::right
+									  << std::setw(10) << size << std::setw(8) << nthreads << std::setw(8)
+									  << streams << "  " << std::left << std::setw(10) << STAGES[stage]
+									  << std::right << std::fixed << std::setprecision(1) << std::setw(12) << p10
+									  << std::setw(12) << p50 << std::setw(12) << p90 << std::defaultfloat
+									  << std::endl;
+					}
+				}
+			}
+		}
+	}
+	return all_ok ? 0 : 1;
+}
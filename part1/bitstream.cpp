@@ -0,0 +1,22 @@
+// Source code for Test task
+// Licensed after GNU GPL v3
+
+#include "bitstream.h"
+
+namespace HuffmanTree
+{
+
+size_t BlockStream::SymbolCount() const
+{
+	return BlockStreamView(*this).SymbolCount();
+}
+
+size_t BlockStreamView::SymbolCount() const
+{
+	size_t count = 0;
+	for (const auto& block : blocks)
+		count += block.symbol_count;
+	return count;
+}
+
+}
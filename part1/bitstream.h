@@ -0,0 +1,129 @@
+// Source code for Test task
+// Licensed after GNU GPL v3
+
+#ifndef BITSTREAM_H
+#define BITSTREAM_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <span>
+#include <cassert>
+
+namespace HuffmanTree
+{
+
+constexpr unsigned WORD_BITS = 64;
+
+// Bits are packed into 64-bit words starting from the most significant bit,
+// so a code written with BitWriter compares as an integer when read back.
+struct BitStream
+{
+	std::vector<uint64_t> words;
+	size_t bits{0};
+};
+
+inline size_t WordCount(size_t bits)
+{
+	return (bits + WORD_BITS - 1) / WORD_BITS;
+}
+
+// Writes into a buffer sized up front, see WordCount
+class BitWriter
+{
+	uint64_t* out;
+	uint64_t accumulator{0};
+	unsigned free_bits{WORD_BITS};
+
+public:
+	explicit BitWriter(uint64_t* out)
+		: out{out}
+	{}
+
+	// code holds the value in its lowest `length` bits, 1 <= length <= 64
+	void Write(uint64_t code, unsigned length)
+	{
+		assert(length > 0 && length <= WORD_BITS);
+		if (length < free_bits)
+		{
+			free_bits -= length;
+			accumulator |= code << free_bits;
+		}
+		else
+		{
+			unsigned rest = length - free_bits;
+			*out++ = accumulator | (code >> rest);
+			accumulator = rest != 0 ? code << (WORD_BITS - rest) : 0;
+			free_bits = WORD_BITS - rest;
+		}
+	}
+
+	// Stores the partial last word
+	void Flush()
+	{
+		if (free_bits != WORD_BITS)
+			*out++ = accumulator;
+		accumulator = 0;
+		free_bits = WORD_BITS;
+	}
+};
+
+// Returns the 64 bits starting at bit_offset, zero-filled past the last word
+inline uint64_t PeekBits(const uint64_t* words, size_t word_count, size_t bit_offset)
+{
+	size_t index = bit_offset / WORD_BITS;
+	unsigned shift = bit_offset % WORD_BITS;
+	uint64_t high = index < word_count ? words[index] : 0;
+	uint64_t low = index + 1 < word_count ? words[index + 1] : 0;
+	// two-step shift keeps shift == 0 well defined
+	return (high << shift) | ((low >> 1) >> (WORD_BITS - 1 - shift));
+}
+
+// Entropy coder of a block, see ans.h for rANS and blockcodec.h for the
+// local tables
+enum class BlockCoder : uint8_t
+{
+	Huffman,        // the global code table
+	Ans,
+	LocalHuffman,   // a code table of its own ahead of the codes
+	Stored,         // raw 32-bit values
+};
+
+struct BlockInfo
+{
+	size_t bit_offset{0};   // blocks start on a word boundary
+	size_t symbol_count{0};
+	BlockCoder coder{BlockCoder::Huffman};
+};
+
+// Independently decodable blocks sharing one word buffer
+struct BlockStream
+{
+	BitStream data;
+	std::vector<BlockInfo> blocks;
+
+	size_t SymbolCount() const;
+};
+
+// Read-only view of block stream words, owned by a BlockStream or by a
+// memory-mapped file
+struct BlockStreamView
+{
+	std::span<const uint64_t> words;
+	std::span<const BlockInfo> blocks;
+
+	BlockStreamView() = default;
+	BlockStreamView(std::span<const uint64_t> words, std::span<const BlockInfo> blocks)
+		: words{words}, blocks{blocks}
+	{}
+	BlockStreamView(const BlockStream& stream)
+		: words{stream.data.words}, blocks{stream.blocks}
+	{}
+
+	size_t SymbolCount() const;
+};
+
+
+}
+
+#endif // BITSTREAM_H
@@ -0,0 +1,171 @@
+// Source code for Test task
+// Licensed after GNU GPL v3
+
+#include "blockcodec.h"
+#include <stdexcept>
+
+namespace HuffmanTree
+{
+
+namespace
+{
+// Reads of a Stored block past its words give zeros, as with the other coders
+void DecodeStored(const uint64_t* words, size_t word_count, int* out, size_t count)
+{
+	constexpr size_t VALUES_PER_WORD = WORD_BITS / STORED_BITS;
+	for (size_t i = 0; i < count; ++i)
+	{
+		size_t index = i / VALUES_PER_WORD;
+		uint64_t word = index < word_count ? words[index] : 0;
+		unsigned shift = WORD_BITS - STORED_BITS * (i % VALUES_PER_WORD + 1);
+		out[i] = static_cast<int32_t>(static_cast<uint32_t>(word >> shift));
+	}
+}
+}
+
+void WriteLocalTable(const HTDistionary& dictionary, uint64_t* out)
+{
+	BitWriter writer(out);
+	writer.Write(dictionary.symbols.size(), 32);
+	for (size_t i = 0; i < dictionary.symbols.size(); ++i)
+	{
+		writer.Write(static_cast<uint32_t>(dictionary.symbols[i]), 32);
+		writer.Write(dictionary.lengths[i] - 1u, LOCAL_LENGTH_BITS);
+	}
+	writer.Flush();
+}
+
+HTDistionary ReadLocalTable(const uint64_t* words, size_t word_count, size_t max_alphabet)
+{
+	size_t position = 0;
+	auto read = [&](unsigned bits)
+	{
+		uint64_t value = PeekBits(words, word_count, position) >> (WORD_BITS - bits);
+		position += bits;
+		return value;
+	};
+	size_t alphabet = read(32);
+	if (alphabet == 0 || alphabet > max_alphabet || LocalTableWords(alphabet) > word_count)
+		throw std::runtime_error("Local code table is malformed");
+
+	// the Kraft sum in units of 2^-64 may reach exactly 2^64, which wraps to 0
+	std::vector<SymbolLength> lengths(alphabet);
+	uint64_t kraft = 0;
+	bool complete = false;
+	for (auto& [value, length] : lengths)
+	{
+		value = static_cast<int32_t>(static_cast<uint32_t>(read(32)));
+		length = static_cast<uint32_t>(read(LOCAL_LENGTH_BITS)) + 1;
+		uint64_t unit = length < WORD_BITS ? uint64_t{1} << (WORD_BITS - length) : 1;
+		uint64_t sum = kraft + unit;
+		if (complete || (sum < kraft && sum != 0))
+			throw std::runtime_error("Local code table is not a prefix code");
+		complete = sum < kraft;
+		kraft = sum;
+	}
+	return HTDistionary(std::move(lengths));
+}
+
+HTFrequency MergeFrequencies(const std::vector<HTFrequency>& blocks)
+{
+	HTFrequency all;
+	for (const auto& block : blocks)
+		all.insert(all.end(), block.cbegin(), block.cend());
+	std::sort(all.begin(), all.end(), [](const auto& lhs, const auto& rhs)
+	{
+		return lhs.value < rhs.value;
+	});
+	HTFrequency result;
+	for (const auto& symbol : all)
+	{
+		if (!result.empty() && result.back().value == symbol.value)
+			result.back().frequency += symbol.frequency;
+		else
+			result.push_back(symbol);
+	}
+	return result;
+}
+
+std::vector<size_t> BlockCounts(size_t length, size_t block_size)
+{
+	block_size = std::max<size_t>(block_size, 1);
+	std::vector<size_t> counts((length + block_size - 1) / block_size, block_size);
+	if (!counts.empty())
+		counts.back() = length - (counts.size() - 1) * block_size;
+	return counts;
+}
+
+void DecodeBlocks(BlockStreamView data, const BlockCoding& coding, size_t first_block, size_t last_block,
+				  int* out, ThreadPool& pool, CompressStats* stats)
+{
+	bool has_ans = coding.ans != nullptr && !coding.ans->empty();
+	size_t nblocks = last_block - first_block;
+	std::vector<size_t> positions(nblocks);
+	size_t total = 0;
+	for (size_t i = 0; i < nblocks; ++i)
+	{
+		const auto& block = data.blocks[first_block + i];
+		if (block.coder == BlockCoder::Ans && !has_ans)
+			throw std::runtime_error("rANS block without a rANS table");
+		positions[i] = total;
+		total += block.symbol_count;
+	}
+
+	HuffmanDecoder decoder(*coding.dictionary);
+	std::vector<BlockTiming> timings(stats != nullptr ? nblocks : 0);
+	pool.ParallelFor(nblocks, [&](size_t k)
+	{
+		auto start = stats != nullptr ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point{};
+		size_t i = first_block + k;
+		const auto& block = data.blocks[i];
+		int* target = out + positions[k];
+		if (block.coder == BlockCoder::Huffman && coding.streams == 1)
+		{
+			decoder.Decode(data.words.data(), data.words.size(), block.bit_offset, target, block.symbol_count);
+		}
+		else if (block.symbol_count != 0)
+		{
+			// the other layouts are decoded within the words of their block
+			size_t begin = std::min(block.bit_offset / WORD_BITS, data.words.size());
+			size_t end = i + 1 < data.blocks.size() ? data.blocks[i + 1].bit_offset / WORD_BITS
+													: data.words.size();
+			end = std::clamp(end, begin, data.words.size());
+			const uint64_t* words = data.words.data() + begin;
+			size_t word_count = end - begin;
+			switch (block.coder)
+			{
+			case BlockCoder::Huffman:
+				decoder.DecodeStreams(words, word_count, coding.streams, target, block.symbol_count);
+				break;
+			case BlockCoder::Ans:
+				coding.ans->Decode(words, word_count, target, block.symbol_count);
+				break;
+			case BlockCoder::LocalHuffman:
+			{
+				auto table = ReadLocalTable(words, word_count, block.symbol_count);
+				size_t table_words = LocalTableWords(table.symbols.size());
+				HuffmanDecoder(table).DecodeStreams(words + table_words, word_count - table_words,
+													coding.streams, target, block.symbol_count);
+				break;
+			}
+			case BlockCoder::Stored:
+				DecodeStored(words, word_count, target, block.symbol_count);
+				break;
+			}
+		}
+		if (stats != nullptr)
+			timings[k] = {i, ThreadPool::CurrentThread(), StageTimer::Elapsed(start)};
+	});
+	if (stats != nullptr)
+		stats->decode_blocks.insert(stats->decode_blocks.end(), timings.cbegin(), timings.cend());
+}
+
+std::vector<int> DecompressBlocks(BlockStreamView data, const BlockCoding& coding, ThreadPool& pool,
+								  CompressStats* stats)
+{
+	std::vector<int> result(data.SymbolCount());
+	DecodeBlocks(data, coding, 0, data.blocks.size(), result.data(), pool, stats);
+	return result;
+}
+
+}
@@ -0,0 +1,264 @@
+// Source code for Test task
+// Licensed after GNU GPL v3
+
+#ifndef BLOCKCODEC_H
+#define BLOCKCODEC_H
+
+#include <algorithm>
+#include <iterator>
+#include <vector>
+#include "huffmantree.h"
+#include "ans.h"
+#include "stats.h"
+
+namespace HuffmanTree
+{
+
+// How the blocks of one stream are entropy coded
+struct BlockCoding
+{
+	const HTDistionary* dictionary{nullptr};
+	const AnsTable* ans{nullptr};   // rANS is tried for every block when non-empty
+	unsigned streams{1};            // Huffman sub-streams per block, see MAX_STREAMS
+	// Frequencies of every block; when given, a block may also carry a
+	// local code table or be stored raw
+	const std::vector<HTFrequency>* block_frequency{nullptr};
+	uint32_t max_code_length{0};    // limit of the local tables, 0 for none
+};
+
+// A LocalHuffman block opens with its code table: the symbol count in 32
+// bits, then every symbol in canonical order as its 32-bit value and its
+// code length - 1 in LOCAL_LENGTH_BITS bits. The codes, in the block's
+// sub-stream layout, start on the next word.
+constexpr unsigned LOCAL_LENGTH_BITS = 6;
+constexpr unsigned STORED_BITS = 32;
+
+inline size_t LocalTableWords(size_t alphabet)
+{
+	return WordCount(32 + alphabet * (32 + LOCAL_LENGTH_BITS));
+}
+
+// Writes the table to out, LocalTableWords of the alphabet long
+void WriteLocalTable(const HTDistionary& dictionary, uint64_t* out);
+
+// Reads a table of at most max_alphabet symbols; throws std::runtime_error
+// when it does not fit into word_count words or is not a prefix code
+HTDistionary ReadLocalTable(const uint64_t* words, size_t word_count, size_t max_alphabet);
+
+// Frequencies of every block on the pool
+template<std::random_access_iterator It>
+std::vector<HTFrequency> CountBlocks(It first, const std::vector<size_t>& counts, ThreadPool& pool)
+{
+	std::vector<size_t> starts(counts.size());
+	for (size_t i = 1; i < counts.size(); ++i)
+		starts[i] = starts[i - 1] + counts[i - 1];
+	std::vector<HTFrequency> result(counts.size());
+	pool.ParallelFor(counts.size(), [&](size_t i)
+	{
+		auto begin = first + starts[i];
+		result[i] = MakeHuffmanFrequency(begin, begin + counts[i], ThreadPool::Serial());
+	});
+	return result;
+}
+
+// Frequencies of the whole stream from those of its blocks
+HTFrequency MergeFrequencies(const std::vector<HTFrequency>& blocks);
+
+// Huffman sub-stream bits of the block and, with rANS, its estimated bits
+template<std::random_access_iterator It>
+double SizeBlock(It first, size_t count, const BlockCoding& coding, size_t* stream_bits)
+{
+	const auto& dictionary = *coding.dictionary;
+	std::fill(stream_bits, stream_bits + coding.streams, 0);
+	double ans_bits = AnsTable::FlushBits();
+	bool use_ans = coding.ans != nullptr && !coding.ans->empty();
+	for (size_t i = 0, s = 0; i < count; ++i)
+	{
+		const auto& code = dictionary.Code(first[i]);
+		stream_bits[s] += code.length;
+		if (use_ans)
+			ans_bits += coding.ans->Cost(code.index);
+		s = s + 1 == coding.streams ? 0 : s + 1;
+	}
+	return use_ans ? ans_bits : 0;
+}
+
+// Codes blocks of the given lengths in one preallocated buffer: a sizing
+// pass per block, a prefix sum for the word offsets, then an encoding pass
+// straight into place. A block goes to rANS when its estimate beats the
+// Huffman size; rANS blocks are encoded during sizing into their own
+// buffers and copied into place afterwards. With block frequencies the
+// sizing pass also weighs a local table and raw storage for every block.
+// stats, when given, receives the encode and concatenation stages and the
+// time of every block.
+template<std::random_access_iterator It>
+BlockStream CompressBlocks(It first, const std::vector<size_t>& counts, const BlockCoding& coding,
+						   ThreadPool& pool, CompressStats* stats = nullptr)
+{
+	if (!ValidStreamCount(coding.streams))
+		throw std::invalid_argument("Unsupported Huffman sub-stream count");
+	const auto& dictionary = *coding.dictionary;
+	unsigned streams = coding.streams;
+	size_t nblocks = counts.size();
+	std::vector<size_t> starts(nblocks);
+	for (size_t i = 1; i < nblocks; ++i)
+		starts[i] = starts[i - 1] + counts[i - 1];
+
+	BlockStream result;
+	result.blocks.resize(nblocks);
+	std::vector<size_t> bits(nblocks);
+	std::vector<size_t> stream_bits(nblocks * streams);
+	std::vector<BitStream> ans_blocks(nblocks);
+	std::vector<HTDistionary> local(coding.block_frequency != nullptr ? nblocks : 0);
+	// one timing per block and pass, the passes may run a block on different threads
+	std::vector<BlockTiming> timings(stats != nullptr ? 2 * nblocks : 0);
+	auto now = [stats]
+	{
+		return stats != nullptr ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point{};
+	};
+	auto record = [&timings, stats](size_t entry, size_t block, std::chrono::steady_clock::time_point start)
+	{
+		if (stats != nullptr)
+			timings[entry] = {block, ThreadPool::CurrentThread(), StageTimer::Elapsed(start)};
+	};
+
+	auto sizing_start = now();
+	pool.ParallelFor(nblocks, [&](size_t i)
+	{
+		auto start = now();
+		size_t n = counts[i];
+		auto begin = first + starts[i];
+		result.blocks[i].symbol_count = n;
+		double ans_bits = SizeBlock(begin, n, coding, &stream_bits[i * streams]);
+		size_t huffman_bits = StreamedBlockBits(&stream_bits[i * streams], streams);
+		bits[i] = huffman_bits;
+		if (ans_bits != 0 && ans_bits < huffman_bits)
+		{
+			ans_blocks[i] = coding.ans->Encode(begin, n, dictionary);
+			if (ans_blocks[i].bits < huffman_bits)
+			{
+				bits[i] = ans_blocks[i].bits;
+				result.blocks[i].coder = BlockCoder::Ans;
+			}
+			else
+			{
+				ans_blocks[i] = {};
+			}
+		}
+		if (coding.block_frequency != nullptr)
+		{
+			BlockCoder coder = result.blocks[i].coder;
+			if (n * STORED_BITS < bits[i])
+			{
+				bits[i] = n * STORED_BITS;
+				coder = BlockCoder::Stored;
+			}
+			// the code bits without stream padding bound the local size from
+			// below, the exact size is only taken when that bound wins
+			HuffmanArena arena;
+			std::vector<SymbolLength> lengths;
+			auto cost = MakeCodeLengths((*coding.block_frequency)[i], arena, lengths, coding.max_code_length);
+			size_t table_bits = LocalTableWords(lengths.size()) * WORD_BITS;
+			if (table_bits + cost.bits < bits[i])
+			{
+				HTDistionary local_dictionary(std::move(lengths));
+				std::vector<size_t> local_bits(streams);
+				StreamBits(begin, n, local_dictionary, streams, local_bits.data());
+				size_t local_total = table_bits + StreamedBlockBits(local_bits.data(), streams);
+				if (local_total < bits[i])
+				{
+					bits[i] = local_total;
+					coder = BlockCoder::LocalHuffman;
+					std::copy(local_bits.cbegin(), local_bits.cend(), &stream_bits[i * streams]);
+					local[i] = std::move(local_dictionary);
+				}
+			}
+			if (coder != BlockCoder::Ans)
+				ans_blocks[i] = {};
+			result.blocks[i].coder = coder;
+		}
+		record(i, i, start);
+	});
+	auto concatenation_start = now();
+
+	size_t offset = 0;
+	for (size_t i = 0; i < nblocks; ++i)
+	{
+		result.blocks[i].bit_offset = offset;
+		offset += WordCount(bits[i]) * WORD_BITS;
+	}
+	result.data.words.resize(offset / WORD_BITS);
+	result.data.bits = nblocks != 0 ? result.blocks.back().bit_offset + bits.back() : 0;
+	auto encode_start = now();
+
+	pool.ParallelFor(nblocks, [&](size_t i)
+	{
+		auto start = now();
+		uint64_t* out = result.data.words.data() + result.blocks[i].bit_offset / WORD_BITS;
+		auto begin = first + starts[i];
+		size_t n = result.blocks[i].symbol_count;
+		const HTDistionary* table = &dictionary;
+		switch (result.blocks[i].coder)
+		{
+		case BlockCoder::Ans:
+			std::copy(ans_blocks[i].words.cbegin(), ans_blocks[i].words.cend(), out);
+			table = nullptr;
+			break;
+		case BlockCoder::Stored:
+		{
+			BitWriter writer(out);
+			for (size_t k = 0; k < n; ++k)
+				writer.Write(static_cast<uint32_t>(begin[k]), STORED_BITS);
+			writer.Flush();
+			table = nullptr;
+			break;
+		}
+		case BlockCoder::LocalHuffman:
+			table = &local[i];
+			WriteLocalTable(*table, out);
+			out += LocalTableWords(table->symbols.size());
+			break;
+		case BlockCoder::Huffman:
+			break;
+		}
+		if (table != nullptr && streams == 1)
+			HuffmanEncode(begin, begin + n, *table, out);
+		else if (table != nullptr)
+			HuffmanEncodeStreams(begin, n, *table, streams, &stream_bits[i * streams], out);
+		if (!local.empty())
+			local[i] = {};
+		record(nblocks + i, i, start);
+	});
+
+	if (stats != nullptr)
+	{
+		uint64_t payload_bytes = result.data.words.size() * sizeof(uint64_t);
+		stats->encode.seconds += StageTimer::Elapsed(encode_start)
+								 + std::chrono::duration<double>(concatenation_start - sizing_start).count();
+		stats->encode.input_bytes += (starts.empty() ? 0 : starts.back() + counts.back()) * sizeof(*first);
+		stats->encode.output_bytes += payload_bytes;
+		stats->concatenation.seconds += std::chrono::duration<double>(encode_start - concatenation_start).count();
+		stats->concatenation.input_bytes += nblocks * sizeof(BlockInfo);
+		stats->concatenation.output_bytes += payload_bytes;
+		stats->encode_blocks.insert(stats->encode_blocks.end(), timings.cbegin(), timings.cend());
+	}
+	return result;
+}
+
+// Lengths of the blocks that split length symbols into block_size ones
+std::vector<size_t> BlockCounts(size_t length, size_t block_size);
+
+// Decodes blocks [first_block, last_block) of data on the pool, each
+// straight into its place in out, which must have room for all their
+// symbols; throws std::runtime_error on blocks the coding cannot decode.
+// stats, when given, receives the time of every block.
+void DecodeBlocks(BlockStreamView data, const BlockCoding& coding, size_t first_block, size_t last_block,
+				  int* out, ThreadPool& pool = ThreadPool::Serial(), CompressStats* stats = nullptr);
+
+// DecodeBlocks over all the blocks into a new vector
+std::vector<int> DecompressBlocks(BlockStreamView data, const BlockCoding& coding,
+								  ThreadPool& pool = ThreadPool::Serial(), CompressStats* stats = nullptr);
+
+}
+
+#endif // BLOCKCODEC_H
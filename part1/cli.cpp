@@ -0,0 +1,139 @@
+// Source code for Test task
+// Licensed after GNU GPL v3
+
+// File-to-file compressor over the pipeline of pipeline.h. compress takes
+// raw host-order int32 values and writes the frame stream of
+// StreamCompressor, decompress turns it back. A progress line goes to
+// stderr and the report to stdout unless --quiet is given.
+//
+// Usage: data_compressor_cli compress|decompress INPUT OUTPUT [--threads N] [--memory MB]
+//                            [--chunk N] [--streams N] [--coder huffman|auto] [--adaptive]
+//                            [--transforms delta,zigzag,rle,for] [--no-mmap] [--quiet]
+
+#include <iostream>
+#include <cstring>
+#include <exception>
+#include <string>
+#include "pipeline.h"
+
+using namespace HuffmanTree;
+
+namespace
+{
+struct Options
+{
+	bool compress{true};
+	std::string input;
+	std::string output;
+	bool quiet{false};
+	PipelineOptions pipeline;
+};
+
+bool ParseTransforms(const char* text, std::vector<Transform>& transforms)
+{
+	std::string item;
+	for (const char* c = text;; ++c)
+	{
+		if (*c == ',' || *c == '\0')
+		{
+			if (item == "delta")
+				transforms.push_back(Transform::Delta);
+			else if (item == "zigzag")
+				transforms.push_back(Transform::ZigZag);
+			else if (item == "rle")
+				transforms.push_back(Transform::RunLength);
+			else if (item == "for")
+				transforms.push_back(Transform::FrameOfReference);
+			else if (!item.empty())
+				return false;
+			item.clear();
+			if (*c == '\0')
+				break;
+		}
+		else
+		{
+			item += *c;
+		}
+	}
+	return transforms.size() <= MAX_TRANSFORMS;
+}
+
+bool ParseOptions(int argc, char* argv[], Options& options)
+{
+	if (argc < 4)
+		return false;
+	if (std::strcmp(argv[1], "compress") == 0)
+		options.compress = true;
+	else if (std::strcmp(argv[1], "decompress") == 0)
+		options.compress = false;
+	else
+		return false;
+	options.input = argv[2];
+	options.output = argv[3];
+
+	auto& pipeline = options.pipeline;
+	for (int i = 4; i < argc; ++i)
+	{
+		bool has_value = i + 1 < argc;
+		if (std::strcmp(argv[i], "--threads") == 0 && has_value)
+			pipeline.threads = std::stoull(argv[++i]);
+		else if (std::strcmp(argv[i], "--memory") == 0 && has_value)
+			pipeline.memory_budget = std::stoull(argv[++i]) << 20;
+		else if (std::strcmp(argv[i], "--chunk") == 0 && has_value)
+			pipeline.chunk_size = std::stoull(argv[++i]);
+		else if (std::strcmp(argv[i], "--streams") == 0 && has_value)
+			pipeline.compress.streams = static_cast<unsigned>(std::stoul(argv[++i]));
+		else if (std::strcmp(argv[i], "--coder") == 0 && has_value)
+		{
+			const char* coder = argv[++i];
+			if (std::strcmp(coder, "huffman") == 0)
+				pipeline.compress.coder = EntropyCoder::Huffman;
+			else if (std::strcmp(coder, "auto") == 0)
+				pipeline.compress.coder = EntropyCoder::Auto;
+			else
+				return false;
+		}
+		else if (std::strcmp(argv[i], "--adaptive") == 0)
+			pipeline.compress.adaptive = true;
+		else if (std::strcmp(argv[i], "--transforms") == 0 && has_value)
+		{
+			if (!ParseTransforms(argv[++i], pipeline.compress.transforms))
+				return false;
+		}
+		else if (std::strcmp(argv[i], "--no-mmap") == 0)
+			pipeline.use_mmap = false;
+		else if (std::strcmp(argv[i], "--quiet") == 0)
+			options.quiet = true;
+		else
+			return false;
+	}
+	if (!options.quiet)
+		pipeline.progress = &std::cerr;
+	return ValidStreamCount(pipeline.compress.streams);
+}
+}
+
+int main(int argc, char* argv[])
+{
+	Options options;
+	try
+	{
+		if (!ParseOptions(argc, argv, options))
+		{
+			std::cerr << "Usage: " << argv[0] << " compress|decompress INPUT OUTPUT [--threads N] [--memory MB]"
+					  << " [--chunk N] [--streams N] [--coder huffman|auto] [--adaptive]"
+					  << " [--transforms delta,zigzag,rle,for] [--no-mmap] [--quiet]" << std::endl;
+			return 1;
+		}
+		auto report = options.compress ? CompressFile(options.input, options.output, options.pipeline)
+									   : DecompressFile(options.input, options.output, options.pipeline);
+		if (!options.quiet)
+			report.Print(std::cout);
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << "Error: " << e.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
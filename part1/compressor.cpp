@@ -2,45 +2,330 @@
 // Licensed after GNU GPL v3
 
 #include "compressor.h"
-#include <bitset>
-#include <numeric>
+#include "fileformat.h"
+#include "mappedfile.h"
+#include <cstdint>
+#include <cstring>
 #include <iostream>
 #include <fstream>
 
+using namespace FileFormat;
+
+BlockStreamView CompressedData::View() const
+{
+	if (storage != nullptr)
+		return {stored_words, compressed_data.blocks};
+	return compressed_data;
+}
+
+void CompressedData::IndexBlocks()
+{
+	const auto& blocks = compressed_data.blocks;
+	block_index.resize(blocks.size());
+	size_t position = 0;
+	for (size_t i = 0; i < blocks.size(); ++i)
+	{
+		// transformed blocks restore transform_block_size values each
+		block_index[i] = transforms.empty() ? position : i * transform_block_size;
+		position += blocks[i].symbol_count;
+	}
+}
+
+void CompressedData::DecodeRange(size_t first_index, size_t count, int* out) const
+{
+	if (first_index > symbol_count || count > symbol_count - first_index)
+		throw std::out_of_range("Range is past the end of the compressed data");
+	if (count == 0)
+		return;
+	StageTimer timer(Stage(&CompressStats::decode));
+	auto view = View();
+	size_t first_block = std::upper_bound(block_index.cbegin(), block_index.cend(), first_index)
+						 - block_index.cbegin() - 1;
+	size_t last_block = std::lower_bound(block_index.cbegin(), block_index.cend(), first_index + count)
+						- block_index.cbegin();
+	size_t begin = block_index[first_block];
+	size_t end = last_block < block_index.size() ? block_index[last_block] : symbol_count;
+	auto blocks = view.blocks.subspan(first_block, last_block - first_block);
+
+	// whole blocks go straight into out, partial ones through a buffer
+	std::vector<int> buffer;
+	int* target = out;
+	if (begin != first_index || end != first_index + count)
+	{
+		buffer.resize(end - begin);
+		target = buffer.data();
+	}
+	if (transforms.empty())
+	{
+		DecodeBlocks(view, Coding(), first_block, last_block, target, *pool, stats);
+	}
+	else
+	{
+		std::vector<int> decoded(BlockStreamView({}, blocks).SymbolCount());
+		DecodeBlocks(view, Coding(), first_block, last_block, decoded.data(), *pool, stats);
+		UntransformBlocks(decoded, blocks, transforms, transform_block_size, end - begin, target, *pool);
+	}
+	if (target != out)
+		std::copy_n(buffer.cbegin() + (first_index - begin), count, out);
+
+	if (stats != nullptr)
+	{
+		size_t first_word = std::min(blocks.front().bit_offset / WORD_BITS, view.words.size());
+		size_t last_word = last_block < view.blocks.size() ? view.blocks[last_block].bit_offset / WORD_BITS
+														   : view.words.size();
+		stats->decode.input_bytes += (std::max(last_word, first_word) - first_word) * sizeof(uint64_t);
+		stats->decode.output_bytes += count * sizeof(int);
+	}
+}
+
 std::vector<int> CompressedData::Decompress() const
 {
-	return HuffmanDecompress(compressed_data.cbegin(), compressed_data.cend(), tree);
+	std::vector<int> result(symbol_count);
+	DecodeRange(0, symbol_count, result.data());
+	return result;
+}
+
+void CompressedData::Decompress(std::span<int> out) const
+{
+	if (out.size() < symbol_count)
+		throw std::invalid_argument("Output is smaller than the compressed data");
+	DecodeRange(0, symbol_count, out.data());
+}
+
+std::vector<int> CompressedData::DecompressRange(size_t first_index, size_t count) const
+{
+	if (first_index > symbol_count || count > symbol_count - first_index)
+		throw std::out_of_range("Range is past the end of the compressed data");
+	std::vector<int> result(count);
+	DecodeRange(first_index, count, result.data());
+	return result;
+}
+
+void CompressedData::DecompressRange(size_t first_index, std::span<int> out) const
+{
+	DecodeRange(first_index, out.size(), out.data());
+}
+
+size_t CompressedData::BlocksOffset() const
+{
+	return AlignUp(sizeof(FileHeader) + dictionary.MaxLength() * sizeof(uint32_t)
+				   + dictionary.symbols.size() * sizeof(int32_t)
+				   + ans.Frequencies().size() * sizeof(uint16_t));
 }
 
 size_t CompressedData::SizeOfData() const
 {
-	// TODO calculate size of Huffman Tree
-	size_t size = compressed_data.size() / CHAR_BIT;
-	for (const auto& [key, value] : dictionary)
-		size += sizeof(key) + value.size() / CHAR_BIT;
-	return size;
+	auto view = View();
+	return BlocksOffset() + view.blocks.size() * 2 * sizeof(uint64_t) + view.words.size() * sizeof(uint64_t);
+}
+
+void CompressedData::Write(std::ostream& output) const
+{
+	auto view = View();
+	uint32_t max_length = dictionary.MaxLength();
+	std::vector<uint32_t> length_count(max_length, 0);
+	for (auto length : dictionary.lengths)
+		length_count[length - 1]++;
+
+	FileHeader header{};
+	std::copy(std::begin(MAGIC), std::end(MAGIC), header.magic);
+	header.version = VERSION;
+	header.header_size = sizeof(FileHeader);
+	header.endian_mark = ENDIAN_MARK;
+	header.max_code_length = max_length;
+	header.symbol_count = symbol_count;
+	header.alphabet_size = dictionary.symbols.size();
+	header.block_count = view.blocks.size();
+	header.ans_precision = ans.empty() ? 0 : AnsTable::PROB_BITS;
+	header.transforms = PackTransforms(transforms);
+	header.transform_block_size = transform_block_size;
+	header.huffman_streams = streams;
+	const auto& ans_frequency = ans.Frequencies();
+	size_t blocks_offset = BlocksOffset();
+	header.payload_offset = blocks_offset + view.blocks.size() * 2 * sizeof(uint64_t);
+	header.payload_words = view.words.size();
+	header.payload_bits = compressed_data.data.bits;
+	header.file_size = header.payload_offset + view.words.size() * sizeof(uint64_t);
+
+	// Everything but the payload is assembled in memory, the payload is
+	// written straight from the word buffer
+	std::vector<unsigned char> metadata(header.payload_offset, 0);
+	auto put = [&metadata](size_t offset, const void* data, size_t size)
+	{
+		if (size != 0)
+			std::memcpy(metadata.data() + offset, data, size);
+	};
+	size_t offset = sizeof(FileHeader);
+	put(offset, length_count.data(), length_count.size() * sizeof(uint32_t));
+	offset += length_count.size() * sizeof(uint32_t);
+	for (int value : dictionary.symbols)
+	{
+		int32_t symbol = value;
+		put(offset, &symbol, sizeof(symbol));
+		offset += sizeof(symbol);
+	}
+	put(offset, ans_frequency.data(), ans_frequency.size() * sizeof(uint16_t));
+	offset = blocks_offset;
+	for (const auto& block : view.blocks)
+	{
+		uint64_t entry[2] = {block.bit_offset,
+							 block.symbol_count | uint64_t{static_cast<uint8_t>(block.coder)} << BLOCK_CODER_SHIFT};
+		put(offset, entry, sizeof(entry));
+		offset += sizeof(entry);
+	}
+
+	header.payload_checksum = Checksum64(view.words.data(), view.words.size() * sizeof(uint64_t));
+	put(0, &header, sizeof(header));
+	header.metadata_checksum = Checksum64(metadata.data(), metadata.size());
+	put(0, &header, sizeof(header));
+
+	output.write(reinterpret_cast<const char*>(metadata.data()), metadata.size());
+	output.write(reinterpret_cast<const char*>(view.words.data()), view.words.size() * sizeof(uint64_t));
+}
+
+void CompressedData::Load(std::shared_ptr<const void> owner, const unsigned char* data, size_t size,
+						  bool verify_payload)
+{
+	FileHeader header;
+	if (size < sizeof(header))
+		throw std::runtime_error("Compressed data is truncated");
+	std::memcpy(&header, data, sizeof(header));
+	if (!std::equal(std::begin(MAGIC), std::end(MAGIC), header.magic))
+		throw std::runtime_error("Not a compressed data file");
+	if (header.endian_mark != ENDIAN_MARK)
+		throw std::runtime_error("Compressed data has a different byte order");
+	if (header.version != VERSION || header.header_size != sizeof(FileHeader))
+		throw std::runtime_error("Unsupported compressed data version");
+	// sizes are bounded by the buffer before any offset arithmetic, so a
+	// crafted header cannot wrap it around
+	if (header.file_size > size || header.payload_offset > header.file_size
+		|| header.payload_offset % sizeof(uint64_t) != 0
+		|| header.payload_words > (SIZE_MAX - header.payload_offset) / sizeof(uint64_t)
+		|| header.payload_offset + header.payload_words * sizeof(uint64_t) != header.file_size
+		|| header.alphabet_size > size / sizeof(int32_t) || header.block_count > size / (2 * sizeof(uint64_t))
+		|| header.max_code_length > WORD_BITS
+		|| (header.ans_precision != 0 && header.ans_precision != AnsTable::PROB_BITS)
+		|| !ValidStreamCount(header.huffman_streams))
+		throw std::runtime_error("Compressed data is truncated or malformed");
+	if (reinterpret_cast<uintptr_t>(data) % alignof(uint64_t) != 0)
+		throw std::runtime_error("Compressed data is not 8-byte aligned");
+
+	size_t ans_count = header.ans_precision != 0 ? header.alphabet_size : 0;
+	size_t ans_offset = sizeof(FileHeader) + header.max_code_length * sizeof(uint32_t)
+						+ header.alphabet_size * sizeof(int32_t);
+	size_t blocks_offset = AlignUp(ans_offset + ans_count * sizeof(uint16_t));
+	if (blocks_offset + header.block_count * 2 * sizeof(uint64_t) != header.payload_offset)
+		throw std::runtime_error("Compressed data is malformed");
+
+	FileHeader unsigned_header = header;
+	unsigned_header.metadata_checksum = 0;
+	std::vector<unsigned char> metadata(data, data + header.payload_offset);
+	std::memcpy(metadata.data(), &unsigned_header, sizeof(unsigned_header));
+	if (Checksum64(metadata.data(), metadata.size()) != header.metadata_checksum)
+		throw std::runtime_error("Compressed data checksum mismatch");
+
+	const uint64_t* words = reinterpret_cast<const uint64_t*>(data + header.payload_offset);
+	if (verify_payload && Checksum64(words, header.payload_words * sizeof(uint64_t)) != header.payload_checksum)
+		throw std::runtime_error("Compressed payload checksum mismatch");
+
+	std::vector<uint32_t> length_count(header.max_code_length);
+	if (!length_count.empty())
+		std::memcpy(length_count.data(), data + sizeof(FileHeader), length_count.size() * sizeof(uint32_t));
+	// the decoder tables are indexed by the canonical codes, which overflow
+	// their lengths unless the lengths form a prefix code
+	if (!IsPrefixCode(length_count))
+		throw std::runtime_error("Compressed data is not a prefix code");
+
+	std::vector<SymbolLength> symbol_lengths;
+	symbol_lengths.reserve(header.alphabet_size);
+	size_t offset = sizeof(FileHeader) + header.max_code_length * sizeof(uint32_t);
+	for (uint32_t length = 1; length <= header.max_code_length; ++length)
+	{
+		uint32_t count = length_count[length - 1];
+		for (uint32_t i = 0; i < count; ++i, offset += sizeof(int32_t))
+		{
+			if (symbol_lengths.size() == header.alphabet_size)
+				throw std::runtime_error("Compressed data is malformed");
+			int32_t value;
+			std::memcpy(&value, data + offset, sizeof(value));
+			symbol_lengths.push_back({value, length});
+		}
+	}
+	if (symbol_lengths.size() != header.alphabet_size)
+		throw std::runtime_error("Compressed data is malformed");
+
+	auto loaded_transforms = UnpackTransforms(header.transforms);
+	// a block holds at most the values left, or what transforming
+	// transform_block_size values can grow to; checked before adding, the
+	// total cannot wrap around to match the header
+	size_t block_limit = loaded_transforms.empty()
+		? SIZE_MAX : MaxTransformedSize(loaded_transforms, header.transform_block_size);
+	std::vector<BlockInfo> blocks(header.block_count);
+	size_t total = 0;
+	uint64_t previous_offset = 0;
+	for (size_t i = 0; i < blocks.size(); ++i)
+	{
+		uint64_t entry[2];
+		std::memcpy(entry, data + blocks_offset + i * sizeof(entry), sizeof(entry));
+		auto coder = static_cast<BlockCoder>(entry[1] >> BLOCK_CODER_SHIFT);
+		blocks[i] = {entry[0], entry[1] & BLOCK_COUNT_MASK, coder};
+		size_t count_limit = loaded_transforms.empty() ? header.symbol_count - total
+													   : std::min(block_limit, SIZE_MAX - total);
+		bool known_coder = coder == BlockCoder::Huffman || coder == BlockCoder::LocalHuffman
+						   || coder == BlockCoder::Stored || (coder == BlockCoder::Ans && ans_count != 0);
+		// the block index is searched by offset, so offsets must not go back
+		if (entry[0] > header.payload_words * WORD_BITS || entry[0] < previous_offset
+			|| blocks[i].symbol_count > count_limit || !known_coder)
+			throw std::runtime_error("Compressed data is malformed");
+		total += blocks[i].symbol_count;
+		previous_offset = entry[0];
+	}
+	// transformed blocks hold transform_block_size values each once restored
+	bool blocks_match = loaded_transforms.empty()
+		? total == header.symbol_count && header.transform_block_size == 0
+		: header.transform_block_size != 0
+		  && header.block_count == header.symbol_count / header.transform_block_size
+								   + (header.symbol_count % header.transform_block_size != 0);
+	if (!blocks_match)
+		throw std::runtime_error("Compressed data is malformed");
+
+	HTDistionary loaded_dictionary(std::move(symbol_lengths));
+	AnsTable loaded_ans;
+	if (ans_count != 0)
+	{
+		std::vector<uint16_t> ans_frequency(ans_count);
+		std::memcpy(ans_frequency.data(), data + ans_offset, ans_count * sizeof(uint16_t));
+		try
+		{
+			loaded_ans = AnsTable(loaded_dictionary, std::move(ans_frequency));
+		}
+		catch (const std::invalid_argument&)
+		{
+			throw std::runtime_error("Compressed data is malformed");
+		}
+	}
+
+	dictionary = std::move(loaded_dictionary);
+	ans = std::move(loaded_ans);
+	compressed_data = BlockStream{};
+	compressed_data.data.bits = header.payload_bits;
+	compressed_data.blocks = std::move(blocks);
+	symbol_count = header.symbol_count;
+	transforms = std::move(loaded_transforms);
+	transform_block_size = header.transform_block_size;
+	streams = header.huffman_streams;
+	IndexBlocks();
+	code_cost = {};
+	stored_words = {words, header.payload_words};
+	storage = std::move(owner);
 }
 
 void CompressedData::WriteToFile(const std::string& filename) const
 {
-	// TODO write dictionary
 	std::ofstream output_file(filename, std::ios::binary);
 	if (output_file.is_open())
 	{
-		constexpr size_t size = 32;
-		std::bitset<size> bits;
-		static_assert(bits.size() <= std::numeric_limits<unsigned long>::digits, "too many bits");
-		int index = 0;
-		for (auto i : compressed_data)
-		{
-			bits.set(index++, i);
-			if (index == size)
-			{
-				unsigned long n = bits.to_ulong();
-				output_file.write(reinterpret_cast<const char*>(&n), sizeof(n));
-				index = 0;
-			}
-		}
+		Write(output_file);
 		output_file.close();
 	}
 	else
@@ -49,26 +334,17 @@ void CompressedData::WriteToFile(const std::string& filename) const
 	}
 }
 
-void CompressedData::ReadFromFile(const std::string& filename)
+void CompressedData::ReadFromFile(const std::string& filename, bool verify_payload)
 {
-	// TODO read dictionary
-	std::ifstream  input_file(filename, std::ios::binary);
-	if (input_file.is_open())
+	std::shared_ptr<MappedFile> file;
+	try
 	{
-		compressed_data.clear();
-		char ch;
-		while (input_file.get(ch))
-		{
-			std::bitset<CHAR_BIT> bits(ch);
-			for (int i = 0; i < CHAR_BIT; ++i)
-			{
-				compressed_data.push_back(bits[i]);
-			}
-		}
-		input_file.close();
+		file = std::make_shared<MappedFile>(filename);
 	}
-	else
+	catch (const std::runtime_error&)
 	{
-		std::cerr << "Failed to open the file for writing." << std::endl;
+		std::cerr << "Failed to open the file for reading." << std::endl;
+		return;
 	}
+	Load(file, file->data(), file->size(), verify_payload);
 }
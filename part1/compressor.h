@@ -7,40 +7,261 @@
 #include <string>
 #include <unordered_map>
 #include <vector>
+#include <memory>
+#include <ostream>
+#include <iterator>
+#include <span>
 #include "huffmantree.h"
+#include "blockcodec.h"
+#include "transform.h"
 
 using namespace HuffmanTree;
 
+enum class EntropyCoder
+{
+	Huffman,    // every block Huffman coded
+	Auto,       // rANS for the blocks where it is estimated smaller
+};
+
+struct CompressOptions
+{
+	size_t block_size{DEFAULT_BLOCK_SIZE};   // symbols per independently decodable block
+	uint32_t max_code_length{0};             // 0 keeps unconstrained Huffman lengths
+	EntropyCoder coder{EntropyCoder::Huffman};
+	unsigned streams{1};                     // interleaved Huffman sub-streams: 1, 2, 4 or 8
+	// every block counts its own frequencies and takes the global table, a
+	// local one or raw storage, whichever is smallest; the global table is
+	// merged from the block counts instead of a separate pass
+	bool adaptive{false};
+	// applied to every block in order before counting, at most MAX_TRANSFORMS
+	std::vector<Transform> transforms;
+};
+
 class CompressedData
 {
 private:
-	std::vector<bool> compressed_data;
+	BlockStream compressed_data;
 	HTDistionary dictionary;
-	HTNptr tree;
+	AnsTable ans;               // empty unless some block is rANS coded
+	unsigned streams{1};
+	size_t symbol_count{0};     // values before the transforms
+	std::vector<Transform> transforms;
+	size_t transform_block_size{0};
+	// first value of every block, for decoding a range without the blocks
+	// before it
+	std::vector<size_t> block_index;
+	CodeCost code_cost;
+	ThreadPool* pool{&ThreadPool::Default()};
+	CompressStats* stats{nullptr};
+
+	// Set when the words live in a loaded file instead of compressed_data
+	std::shared_ptr<const void> storage;
+	std::span<const uint64_t> stored_words;
+
+	BlockStreamView View() const;
+	BlockCoding Coding() const { return {&dictionary, &ans, streams}; }
+	// Start of the block table in the Write image, the payload follows it
+	size_t BlocksOffset() const;
+	void IndexBlocks();
+	// Decodes values [first_index, first_index + count) into out, touching
+	// only the blocks that hold them
+	void DecodeRange(size_t first_index, size_t count, int* out) const;
+	StageStats* Stage(StageStats CompressStats::*stage) const
+	{
+		return stats != nullptr ? &(stats->*stage) : nullptr;
+	}
+
+	template<std::input_iterator It>
+	void CompressWith(It first, It last, const CompressOptions& options, ThreadPool& workers)
+	{
+		if constexpr (!std::random_access_iterator<It>)
+		{
+			// the block coders index into the input, other ranges are
+			// gathered into a buffer first
+			std::vector<int> buffer(first, last);
+			CompressWith(buffer.cbegin(), buffer.cend(), options, workers);
+		}
+		else
+		{
+			CompressRandomAccess(first, last, options, workers);
+		}
+	}
+
+	template<std::random_access_iterator It>
+	void CompressRandomAccess(It first, It last, const CompressOptions& options, ThreadPool& workers)
+	{
+		if (options.transforms.size() > MAX_TRANSFORMS)
+			throw std::invalid_argument("Too many transforms");
+		if (!ValidStreamCount(options.streams))
+			throw std::invalid_argument("Unsupported Huffman sub-stream count");
+		storage.reset();
+		symbol_count = std::distance(first, last);
+		transforms = options.transforms;
+		transform_block_size = transforms.empty() ? 0 : std::max<size_t>(options.block_size, 1);
+		if (transforms.empty())
+		{
+			Encode(first, last, BlockCounts(symbol_count, options.block_size), options, workers);
+			return;
+		}
+		// a transformed block stays one coded block, so blocks decode and
+		// untransform independently
+		TransformedBlocks transformed;
+		{
+			StageTimer timer(Stage(&CompressStats::transform));
+			transformed = TransformBlocks(first, last, transforms, options.block_size, workers);
+		}
+		if (stats != nullptr)
+		{
+			stats->transform.input_bytes += symbol_count * sizeof(int);
+			stats->transform.output_bytes += transformed.values.size() * sizeof(int);
+		}
+		Encode(transformed.values.cbegin(), transformed.values.cend(), transformed.counts, options, workers);
+	}
+
+	template<std::random_access_iterator It>
+	void Encode(It first, It last, const std::vector<size_t>& counts, const CompressOptions& options,
+				ThreadPool& workers)
+	{
+		HTFrequency frequency;
+		std::vector<HTFrequency> block_frequency;
+		{
+			StageTimer timer(Stage(&CompressStats::frequency));
+			if (options.adaptive)
+			{
+				block_frequency = CountBlocks(first, counts, workers);
+				frequency = MergeFrequencies(block_frequency);
+			}
+			else
+			{
+				frequency = MakeHuffmanFrequency(first, last, workers);
+			}
+		}
+		std::vector<SymbolLength> lengths;
+		{
+			StageTimer timer(Stage(&CompressStats::tree));
+			HuffmanArena arena;
+			code_cost = MakeCodeLengths(frequency, arena, lengths, options.max_code_length);
+		}
+		{
+			StageTimer timer(Stage(&CompressStats::dictionary));
+			dictionary = HTDistionary(std::move(lengths));
+			ans = options.coder == EntropyCoder::Auto && AnsTable::Fits(dictionary)
+				? AnsTable(dictionary, frequency) : AnsTable{};
+		}
+		if (stats != nullptr)
+		{
+			uint64_t values = std::distance(first, last);
+			uint64_t table_bytes = frequency.size() * sizeof(SymbolFrequency);
+			stats->frequency.input_bytes += values * sizeof(*first);
+			stats->frequency.output_bytes += table_bytes;
+			stats->tree.input_bytes += table_bytes;
+			stats->tree.output_bytes += dictionary.symbols.size() * sizeof(SymbolLength);
+			stats->dictionary.input_bytes += dictionary.symbols.size() * sizeof(SymbolLength);
+			stats->dictionary.output_bytes += dictionary.symbols.size() * (sizeof(int32_t) + sizeof(uint8_t))
+											  + ans.Frequencies().size() * sizeof(uint16_t);
+		}
+		streams = options.streams;
+		BlockCoding coding = Coding();
+		if (options.adaptive)
+		{
+			coding.block_frequency = &block_frequency;
+			coding.max_code_length = options.max_code_length;
+		}
+		compressed_data = CompressBlocks(first, counts, coding, workers, stats);
+		IndexBlocks();
+		if (std::none_of(compressed_data.blocks.cbegin(), compressed_data.blocks.cend(), [](const auto& block)
+			{
+				return block.coder == BlockCoder::Ans;
+			}))
+			ans = {};
+	}
 
 public:
 	CompressedData() = default;
+	// Parallel compression and decompression run on pool instead of the
+	// process-wide default one
+	explicit CompressedData(ThreadPool& pool)
+		: pool{&pool}
+	{}
 
-	template<typename It>
-	void Compress(It first, It last)
+	// Any input iterator of int; ranges without random access are copied
+	// into a buffer before they are split into blocks
+	template<std::input_iterator It>
+	void Compress(It first, It last, const CompressOptions& options = {})
 	{
-		tree = MakeHuffmanTree(first, last);
-		dictionary = MakeHuffmanDictionary(tree);
-		compressed_data = HuffmanCompress(first, last, dictionary);
+		CompressWith(first, last, options, ThreadPool::Serial());
 	}
 
-	template<typename It>
-	void CompressParallel(It first, It last)
+	template<std::input_iterator It>
+	void CompressParallel(It first, It last, const CompressOptions& options = {})
 	{
-		tree = MakeHuffmanTree(first, last);
-		dictionary = MakeHuffmanDictionary(tree);
-		compressed_data = HuffmanCompressParallel(first, last, dictionary);
+		CompressWith(first, last, options, *pool);
 	}
 
+	// Number of values Decompress restores
+	size_t Size() const { return symbol_count; }
+
 	std::vector<int> Decompress() const;
+	// out must have room for Size() values; throws std::invalid_argument
+	// otherwise
+	void Decompress(std::span<int> out) const;
+
+	// Contiguous outputs are decoded into directly, other iterators receive
+	// the values a few blocks at a time
+	template<std::output_iterator<int> OutIt>
+	OutIt Decompress(OutIt out) const
+	{
+		if constexpr (std::contiguous_iterator<OutIt>)
+		{
+			DecodeRange(0, symbol_count, std::to_address(out));
+			return out + symbol_count;
+		}
+		else
+		{
+			size_t batch = std::max<size_t>(pool->Size(), 1);
+			std::vector<int> buffer;
+			for (size_t block = 0; block < block_index.size(); block += batch)
+			{
+				size_t begin = block_index[block];
+				size_t end = block + batch < block_index.size() ? block_index[block + batch] : symbol_count;
+				buffer.resize(end - begin);
+				DecodeRange(begin, end - begin, buffer.data());
+				out = std::copy(buffer.cbegin(), buffer.cend(), out);
+			}
+			return out;
+		}
+	}
+
+	// Values [first_index, first_index + count); throws std::out_of_range
+	// when the range goes past Size()
+	std::vector<int> DecompressRange(size_t first_index, size_t count) const;
+	void DecompressRange(size_t first_index, std::span<int> out) const;
+	BlockStreamView Data() const { return View(); }
+	const HTDistionary& Dictionary() const { return dictionary; }
+	// Empty when all blocks are Huffman coded
+	const AnsTable& Ans() const { return ans; }
+	const std::vector<Transform>& Transforms() const { return transforms; }
+	unsigned Streams() const { return streams; }
+	// Payload bits with the chosen code lengths against unconstrained Huffman
+	// codes, known after compression
+	const CodeCost& Cost() const { return code_cost; }
+	// Exact size in bytes of the image Write produces
 	size_t SizeOfData() const;
+
+	// Records the stages of the following compressions and decompressions
+	// into stats, which must outlive them; nullptr turns recording off
+	void SetStats(CompressStats* stats) { this->stats = stats; }
+
+	// Versioned binary format described in fileformat.h
+	void Write(std::ostream& output) const;
+	// Takes the payload in place from data, which owner keeps alive; throws
+	// std::runtime_error on a malformed or corrupted image
+	void Load(std::shared_ptr<const void> owner, const unsigned char* data, size_t size,
+			  bool verify_payload = true);
+
 	void WriteToFile(const std::string& filename) const;
-	void ReadFromFile(const std::string& filename);
+	// Maps the file and decodes from the mapping without copying the payload
+	void ReadFromFile(const std::string& filename, bool verify_payload = true);
 
 };
 
@@ -0,0 +1,55 @@
+// Source code for Test task
+// Licensed after GNU GPL v3
+
+#include "fileformat.h"
+#include <cstring>
+
+namespace FileFormat
+{
+
+namespace
+{
+constexpr uint64_t PRIME1 = 0x9E3779B185EBCA87ULL;
+constexpr uint64_t PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+
+uint64_t Rotl(uint64_t x, unsigned r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+uint64_t Round(uint64_t acc, uint64_t word)
+{
+	return Rotl(acc + word * PRIME2, 31) * PRIME1;
+}
+}
+
+// Four independent lanes keep the multiplies from serializing on large payloads
+uint64_t Checksum64(const void* data, size_t size, uint64_t seed)
+{
+	const unsigned char* p = static_cast<const unsigned char*>(data);
+	uint64_t lane[4] = {seed + PRIME1 + PRIME2, seed + PRIME2, seed, seed - PRIME1};
+	size_t i = 0;
+	for (; i + 32 <= size; i += 32)
+	{
+		uint64_t words[4];
+		std::memcpy(words, p + i, sizeof(words));
+		for (int k = 0; k < 4; ++k)
+			lane[k] = Round(lane[k], words[k]);
+	}
+	uint64_t hash = Rotl(lane[0], 1) + Rotl(lane[1], 7) + Rotl(lane[2], 12) + Rotl(lane[3], 18);
+	for (; i + 8 <= size; i += 8)
+	{
+		uint64_t word;
+		std::memcpy(&word, p + i, sizeof(word));
+		hash = Rotl(hash ^ Round(0, word), 27) * PRIME1;
+	}
+	for (; i < size; ++i)
+		hash = Rotl(hash ^ (p[i] * PRIME1), 11) * PRIME2;
+	hash ^= size;
+	hash ^= hash >> 33;
+	hash *= PRIME2;
+	hash ^= hash >> 29;
+	return hash;
+}
+
+}
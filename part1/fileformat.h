@@ -0,0 +1,70 @@
+// Source code for Test task
+// Licensed after GNU GPL v3
+
+#ifndef FILEFORMAT_H
+#define FILEFORMAT_H
+
+#include <cstdint>
+#include <cstddef>
+
+// Layout of a compressed file, all integers in host byte order:
+//
+//   FileHeader
+//   uint32_t length_count[max_code_length]   symbols per code length 1..max
+//   int32_t  symbols[alphabet_size]          values in canonical order
+//   uint16_t ans_frequency[alphabet_size]    only when ans_precision != 0
+//   padding to 8 bytes
+//   uint64_t blocks[block_count][2]          bit offset, symbol count with
+//                                            the BlockCoder in the top 8 bits
+//   payload at payload_offset                uint64_t words, MSB-first bits
+//                                            for Huffman blocks, which hold
+//                                            huffman_streams sub-streams;
+//                                            LocalHuffman blocks open with
+//                                            their code table (blockcodec.h)
+//
+// The payload is 8-byte aligned so a mapped file can be decoded in place.
+namespace FileFormat
+{
+
+constexpr char MAGIC[4] = {'H', 'U', 'F', 'C'};
+constexpr uint16_t VERSION = 5;
+constexpr uint32_t ENDIAN_MARK = 0x01020304;
+
+struct FileHeader
+{
+	char magic[4];
+	uint16_t version;
+	uint16_t header_size;
+	uint32_t endian_mark;
+	uint32_t max_code_length;
+	uint64_t file_size;
+	uint64_t symbol_count;        // values the image decodes to
+	uint64_t alphabet_size;
+	uint64_t block_count;
+	uint64_t payload_offset;
+	uint64_t payload_bits;
+	uint64_t payload_words;
+	uint64_t metadata_checksum;  // header with this field zeroed, then metadata
+	uint64_t payload_checksum;
+	uint32_t ans_precision;      // AnsTable::PROB_BITS, 0 without rANS blocks
+	uint32_t transforms;         // PackTransforms, 0 for none
+	uint64_t transform_block_size;  // values per block before the transforms
+	uint32_t huffman_streams;    // sub-streams of every Huffman block
+	uint32_t reserved;
+};
+
+constexpr unsigned BLOCK_CODER_SHIFT = 56;
+constexpr uint64_t BLOCK_COUNT_MASK = (uint64_t{1} << BLOCK_CODER_SHIFT) - 1;
+
+static_assert(sizeof(FileHeader) % 8 == 0, "payload alignment relies on it");
+
+constexpr size_t AlignUp(size_t size, size_t alignment = 8)
+{
+	return (size + alignment - 1) / alignment * alignment;
+}
+
+uint64_t Checksum64(const void* data, size_t size, uint64_t seed = 0);
+
+}
+
+#endif // FILEFORMAT_H
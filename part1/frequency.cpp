@@ -0,0 +1,19 @@
+// Source code for Test task
+// Licensed after GNU GPL v3
+
+#include "frequency.h"
+
+namespace HuffmanTree
+{
+
+size_t DetermineCountThreads(size_t length, const ThreadPool& pool)
+{
+	return std::max<size_t>(1, std::min(pool.Size(), length / MIN_COUNT_PER_THREAD));
+}
+
+bool UseDenseHistogram(size_t range, size_t slice_length)
+{
+	return range <= MAX_DENSE_RANGE && range <= std::max<size_t>(slice_length, 1024);
+}
+
+}
@@ -0,0 +1,382 @@
+// Source code for Test task
+// Licensed after GNU GPL v3
+
+#ifndef FREQUENCY_H
+#define FREQUENCY_H
+
+#include <algorithm>
+#include <bit>
+#include <concepts>
+#include <cstdint>
+#include <tuple>
+#include <iterator>
+#include <limits>
+#include <vector>
+#include "threadpool.h"
+
+namespace HuffmanTree
+{
+
+// Symbol types the coder is built for. Bytes and 16-bit codes are counted
+// and looked up in flat tables over their whole or used range, never hashed.
+template<typename Symbol>
+concept HuffmanSymbol = std::same_as<Symbol, uint8_t> || std::same_as<Symbol, int8_t>
+						|| std::same_as<Symbol, uint16_t> || std::same_as<Symbol, int16_t>
+						|| std::same_as<Symbol, int32_t> || std::same_as<Symbol, int64_t>;
+
+template<typename Symbol>
+constexpr bool SMALL_ALPHABET = sizeof(Symbol) <= 2;
+
+template<HuffmanSymbol Symbol>
+struct BasicSymbolFrequency
+{
+	Symbol value;
+	uint64_t frequency;
+};
+
+// Non-zero frequencies; dense counting yields them ordered by value
+template<HuffmanSymbol Symbol>
+using BasicHTFrequency = std::vector<BasicSymbolFrequency<Symbol>>;
+
+using SymbolFrequency = BasicSymbolFrequency<int>;
+using HTFrequency = BasicHTFrequency<int>;
+
+constexpr size_t MIN_COUNT_PER_THREAD = size_t{1} << 16;
+constexpr size_t MULTI_HISTOGRAM_RANGE = size_t{1} << 16;
+constexpr size_t MAX_DENSE_RANGE = size_t{1} << 22;
+constexpr size_t MAX_SPARSE_RESERVE = size_t{1} << 18;
+
+size_t DetermineCountThreads(size_t length, const ThreadPool& pool);
+
+// Ranges up to MAX_DENSE_RANGE are counted into flat arrays when the slice of
+// every thread is at least as long as the range, since each thread clears,
+// fills and merges a histogram of its own
+bool UseDenseHistogram(size_t range, size_t slice_length);
+
+// Bin of value in a histogram starting at min_value; the difference is taken
+// in 64-bit unsigned arithmetic, so it cannot overflow for any symbol type
+template<HuffmanSymbol Symbol>
+size_t HistogramBin(Symbol value, Symbol min_value)
+{
+	return static_cast<size_t>(static_cast<uint64_t>(value) - static_cast<uint64_t>(min_value));
+}
+
+// Number of bins from min_value to max_value, SIZE_MAX when it is too wide
+// to be counted densely
+template<HuffmanSymbol Symbol>
+size_t HistogramRange(Symbol min_value, Symbol max_value)
+{
+	size_t span = HistogramBin(max_value, min_value);
+	return span < MAX_DENSE_RANGE ? span + 1 : SIZE_MAX;
+}
+
+// Sums thread histograms bin-wise into HTFrequency, splitting the bins
+// between the threads
+template<HuffmanSymbol Symbol>
+BasicHTFrequency<Symbol> MergeHistograms(const std::vector<std::vector<uint64_t>>& histograms,
+										 Symbol min_value, ThreadPool& pool)
+{
+	size_t range = histograms.front().size();
+	size_t nthreads = histograms.size();
+	std::vector<BasicHTFrequency<Symbol>> parts(nthreads);
+	pool.ParallelFor(nthreads, [&](size_t tidx)
+	{
+		size_t begin = range * tidx / nthreads;
+		size_t end = range * (tidx + 1) / nthreads;
+		for (size_t bin = begin; bin < end; ++bin)
+		{
+			uint64_t frequency = 0;
+			for (const auto& histogram : histograms)
+				frequency += histogram[bin];
+			if (frequency != 0)
+				parts[tidx].push_back({static_cast<Symbol>(static_cast<uint64_t>(min_value) + bin), frequency});
+		}
+	});
+	BasicHTFrequency<Symbol> result;
+	for (const auto& part : parts)
+		result.insert(result.end(), part.cbegin(), part.cend());
+	return result;
+}
+
+// Counts of a sparse alphabet in an open-addressing table with linear
+// probing, kept at most half full. Unlike a node-based map an insert does
+// not allocate, which is most of the cost when nearly every value is new.
+template<HuffmanSymbol Symbol>
+class BasicFrequencyMap
+{
+	static constexpr unsigned WORD_SHIFT = 64;
+	static constexpr size_t MIN_SLOTS = 16;
+
+	struct Slot
+	{
+		Symbol value;
+		uint64_t frequency;     // 0 marks an empty slot
+	};
+
+	std::vector<Slot> slots;
+	size_t count{0};
+	unsigned shift{WORD_SHIFT};     // Home takes the top bits of the hash
+
+	size_t Home(Symbol value) const
+	{
+		return static_cast<size_t>((static_cast<uint64_t>(value) * 0x9E3779B97F4A7C15ULL) >> shift);
+	}
+
+	void Rehash(size_t capacity)
+	{
+		auto old = std::move(slots);
+		slots.assign(capacity, Slot{});
+		shift = WORD_SHIFT - std::countr_zero(capacity);
+		count = 0;
+		for (const auto& slot : old)
+		{
+			if (slot.frequency != 0)
+				Add(slot.value, slot.frequency);
+		}
+	}
+
+public:
+	void reserve(size_t values)
+	{
+		if (2 * values > slots.size())
+			Rehash(std::bit_ceil(std::max(2 * values, MIN_SLOTS)));
+	}
+
+	// frequency must not be 0
+	void Add(Symbol value, uint64_t frequency = 1)
+	{
+		if (2 * (count + 1) > slots.size())
+			Rehash(std::max(2 * slots.size(), MIN_SLOTS));
+		size_t mask = slots.size() - 1;
+		for (size_t i = Home(value);; i = (i + 1) & mask)
+		{
+			auto& slot = slots[i];
+			if (slot.frequency == 0)
+			{
+				slot = {value, frequency};
+				++count;
+				return;
+			}
+			if (slot.value == value)
+			{
+				slot.frequency += frequency;
+				return;
+			}
+		}
+	}
+
+	size_t size() const
+	{
+		return count;
+	}
+
+	template<typename Function>
+	void ForEach(Function function) const
+	{
+		for (const auto& slot : slots)
+		{
+			if (slot.frequency != 0)
+				function(slot.value, slot.frequency);
+		}
+	}
+
+	void clear()
+	{
+		slots = {};
+		count = 0;
+		shift = WORD_SHIFT;
+	}
+};
+using FrequencyMap = BasicFrequencyMap<int>;
+
+// Sparse counting keeps one map per (thread, partition); partition p of all
+// threads is merged by thread p
+template<HuffmanSymbol Symbol>
+size_t FrequencyPartition(Symbol value, size_t npartitions)
+{
+	uint64_t key = static_cast<uint64_t>(value);
+	if constexpr (sizeof(Symbol) <= sizeof(uint32_t))
+		key = static_cast<uint32_t>(key);
+	else
+		key ^= key >> 32;
+	uint64_t hash = key * 0x9E3779B97F4A7C15ULL;
+	return (hash >> 32) % npartitions;
+}
+
+template<HuffmanSymbol Symbol>
+BasicHTFrequency<Symbol> MergeFrequencyMaps(std::vector<std::vector<BasicFrequencyMap<Symbol>>>& maps,
+											ThreadPool& pool)
+{
+	size_t npartitions = maps.front().size();
+	std::vector<BasicHTFrequency<Symbol>> parts(npartitions);
+	pool.ParallelFor(npartitions, [&](size_t partition)
+	{
+		auto& merged = maps.front()[partition];
+		for (size_t tidx = 1; tidx < maps.size(); ++tidx)
+		{
+			maps[tidx][partition].ForEach([&merged](Symbol value, uint64_t frequency)
+			{
+				merged.Add(value, frequency);
+			});
+			maps[tidx][partition].clear();
+		}
+		parts[partition].reserve(merged.size());
+		merged.ForEach([&](Symbol value, uint64_t frequency)
+		{
+			parts[partition].push_back({value, frequency});
+		});
+	});
+	BasicHTFrequency<Symbol> result;
+	for (const auto& part : parts)
+		result.insert(result.end(), part.cbegin(), part.cend());
+	return result;
+}
+
+template<typename It, typename Symbol = std::iter_value_t<It>>
+std::pair<Symbol, Symbol> FindValueRange(It first, size_t length, size_t nthreads, ThreadPool& pool)
+{
+	std::vector<std::pair<Symbol, Symbol>> ranges(nthreads, {std::numeric_limits<Symbol>::max(),
+															 std::numeric_limits<Symbol>::min()});
+	pool.ParallelFor(nthreads, [&](size_t tidx)
+	{
+		size_t begin = length * tidx / nthreads;
+		size_t end = length * (tidx + 1) / nthreads;
+		Symbol min_value = ranges[tidx].first;
+		Symbol max_value = ranges[tidx].second;
+		for (size_t i = begin; i < end; ++i)
+		{
+			Symbol value = first[i];
+			min_value = std::min(min_value, value);
+			max_value = std::max(max_value, value);
+		}
+		ranges[tidx] = {min_value, max_value};
+	});
+	auto result = ranges.front();
+	for (const auto& [min_value, max_value] : ranges)
+	{
+		result.first = std::min(result.first, min_value);
+		result.second = std::max(result.second, max_value);
+	}
+	return result;
+}
+
+// Adds the values of [first, first + length) to counts. For small ranges the
+// kernel counts into four interleaved sub-histograms, so that runs of equal
+// values do not stall on the store of the previous increment.
+template<typename It, typename Symbol>
+void CountDense(It first, size_t length, Symbol min_value, std::vector<uint64_t>& counts)
+{
+	size_t range = counts.size();
+	size_t ways = range <= MULTI_HISTOGRAM_RANGE && 4 * range <= length ? 4 : 1;
+	std::vector<uint32_t> hist(ways * range, 0);
+	auto index = [min_value](Symbol value)
+	{
+		return HistogramBin(value, min_value);
+	};
+	while (length > 0)
+	{
+		// 32-bit counters cannot overflow within one slice
+		size_t n = std::min<size_t>(length, std::numeric_limits<uint32_t>::max());
+		size_t i = 0;
+		if (ways == 4)
+		{
+			uint32_t* h0 = hist.data();
+			uint32_t* h1 = h0 + range;
+			uint32_t* h2 = h1 + range;
+			uint32_t* h3 = h2 + range;
+			for (; i + 4 <= n; i += 4)
+			{
+				h0[index(first[i])]++;
+				h1[index(first[i + 1])]++;
+				h2[index(first[i + 2])]++;
+				h3[index(first[i + 3])]++;
+			}
+		}
+		for (; i < n; ++i)
+			hist[index(first[i])]++;
+
+		for (size_t w = 0; w < ways; ++w)
+		{
+			for (size_t bin = 0; bin < range; ++bin)
+				counts[bin] += hist[w * range + bin];
+		}
+		first += n;
+		length -= n;
+		if (length > 0)
+			std::fill(hist.begin(), hist.end(), 0);
+	}
+}
+
+// Frequencies of the values in [first, last), counted as the iterator's
+// value type. Byte input skips the range pass and counts over the whole
+// alphabet; 16-bit input always counts densely over its used range.
+template<typename It, HuffmanSymbol Symbol = std::iter_value_t<It>>
+BasicHTFrequency<Symbol> MakeHuffmanFrequency(It first, It last, ThreadPool& pool = ThreadPool::Default())
+{
+	if constexpr (!std::random_access_iterator<It>)
+	{
+		if constexpr (SMALL_ALPHABET<Symbol>)
+		{
+			std::vector<std::vector<uint64_t>> histograms(1);
+			histograms[0].assign(size_t{1} << (8 * sizeof(Symbol)), 0);
+			for (It it = first; it != last; ++it)
+				histograms[0][HistogramBin<Symbol>(*it, std::numeric_limits<Symbol>::min())]++;
+			return MergeHistograms(histograms, std::numeric_limits<Symbol>::min(), pool);
+		}
+		else
+		{
+			std::vector<std::vector<BasicFrequencyMap<Symbol>>> maps(
+				1, std::vector<BasicFrequencyMap<Symbol>>(1));
+			for (It it = first; it != last; ++it)
+				maps[0][0].Add(*it);
+			return MergeFrequencyMaps(maps, pool);
+		}
+	}
+	else
+	{
+		size_t length = std::distance(first, last);
+		if (length == 0)
+			return {};
+		size_t nthreads = DetermineCountThreads(length, pool);
+		Symbol min_value = std::numeric_limits<Symbol>::min();
+		Symbol max_value = std::numeric_limits<Symbol>::max();
+		if constexpr (sizeof(Symbol) > 1)
+			std::tie(min_value, max_value) = FindValueRange(first, length, nthreads, pool);
+		size_t range = HistogramRange(min_value, max_value);
+
+		if (SMALL_ALPHABET<Symbol> || UseDenseHistogram(range, length / nthreads))
+		{
+			std::vector<std::vector<uint64_t>> histograms(nthreads);
+			pool.ParallelFor(nthreads, [&](size_t tidx)
+			{
+				size_t begin = length * tidx / nthreads;
+				size_t end = length * (tidx + 1) / nthreads;
+				histograms[tidx].assign(range, 0);
+				CountDense(first + begin, end - begin, min_value, histograms[tidx]);
+			});
+			return MergeHistograms(histograms, min_value, pool);
+		}
+
+		std::vector<std::vector<BasicFrequencyMap<Symbol>>> maps(
+			nthreads, std::vector<BasicFrequencyMap<Symbol>>(nthreads));
+		pool.ParallelFor(nthreads, [&](size_t tidx)
+		{
+			size_t begin = length * tidx / nthreads;
+			size_t end = length * (tidx + 1) / nthreads;
+			auto& partitions = maps[tidx];
+			// a range wider than the input suggests mostly distinct values
+			for (auto& map : partitions)
+				map.reserve(std::min((end - begin) / nthreads, MAX_SPARSE_RESERVE));
+			for (size_t i = begin; i < end; ++i)
+			{
+				Symbol value = first[i];
+				partitions[FrequencyPartition(value, nthreads)].Add(value);
+			}
+		});
+		return MergeFrequencyMaps(maps, pool);
+	}
+}
+
+}
+
+#endif // FREQUENCY_H
@@ -3,62 +3,553 @@
 
 #include "huffmantree.h"
 #include <iostream>
+#include <algorithm>
 
 namespace HuffmanTree
 {
 
-bool operator <(const HTNptr& lhs, const HTNptr& rhs)
+namespace
 {
-	if (lhs->frequency == rhs->frequency)
-		return lhs->value < rhs->value;
-	return lhs->frequency < rhs->frequency;
+// Turns per-length code counts that may exceed max_length into a complete
+// code no longer than max_length
+void LimitLengthCounts(std::vector<uint32_t>& count, uint32_t max_length)
+{
+	for (size_t length = max_length + 1; length < count.size(); ++length)
+	{
+		count[max_length] += count[length];
+		count[length] = 0;
+	}
+	uint64_t kraft = 0;
+	for (uint32_t length = 1; length <= max_length; ++length)
+		kraft += static_cast<uint64_t>(count[length]) << (max_length - length);
+	// Every clamped code overfills the Kraft sum; each step removes one
+	// deepest code and splits a shorter leaf into two one level down
+	while (kraft > (uint64_t{1} << max_length))
+	{
+		count[max_length]--;
+		for (uint32_t length = max_length - 1; length > 0; --length)
+		{
+			if (count[length] != 0)
+			{
+				count[length]--;
+				count[length + 1] += 2;
+				break;
+			}
+		}
+		kraft--;
+	}
+}
 }
 
-bool operator >(const HTNptr& lhs, const HTNptr& rhs)
+bool IsPrefixCode(const std::vector<uint32_t>& length_count)
 {
-	return !(lhs < rhs);
+	// codes still free at the current length; no table holds 2^40 codes,
+	// so capping it there keeps it exact where it can run out
+	uint64_t left = 1;
+	for (uint32_t count : length_count)
+	{
+		left = std::min<uint64_t>(2 * left, uint64_t{1} << 40);
+		if (count > left)
+			return false;
+		left -= count;
+	}
+	return true;
 }
 
-void TraverseTree(HTNptr node, std::vector<bool> current_code, HTDistionary& codes)
+// Two-queue construction over leaves sorted by frequency: internal nodes are
+// created in non-decreasing weight order, so the cheapest two nodes are
+// always at the heads of the leaf and internal node ranges. Nodes are indices
+// into flat arrays, leaves first, and the last node is the root.
+template<HuffmanSymbol Symbol>
+CodeCost MakeCodeLengths(const BasicHTFrequency<Symbol>& frequency, BasicHuffmanArena<Symbol>& arena,
+						 std::vector<BasicSymbolLength<Symbol>>& lengths, uint32_t max_length)
 {
-	if (node->left != nullptr)
+	lengths.clear();
+	CodeCost cost;
+	auto& leaves = arena.leaves;
+	leaves.clear();
+	for (const auto& symbol : frequency)
+	{
+		if (symbol.frequency != 0)
+			leaves.push_back(symbol);
+	}
+	size_t n = leaves.size();
+	if (n == 0)
+		return cost;
+	if (n == 1)
+	{
+		// a lone symbol still needs one bit per occurrence
+		lengths.push_back({leaves.front().value, 1});
+		cost.bits = cost.unconstrained_bits = leaves.front().frequency;
+		return cost;
+	}
+	if (max_length != 0 && (max_length >= WORD_BITS || n > (size_t{1} << max_length)))
+		throw std::invalid_argument("Code length limit is too small for the alphabet");
+	std::sort(leaves.begin(), leaves.end(), [](const auto& lhs, const auto& rhs)
+	{
+		if (lhs.frequency == rhs.frequency)
+			return lhs.value < rhs.value;
+		return lhs.frequency < rhs.frequency;
+	});
+
+	auto& weight = arena.weight;
+	auto& parent = arena.parent;
+	weight.resize(2 * n - 1);
+	parent.resize(2 * n - 1);
+	for (size_t i = 0; i < n; ++i)
+		weight[i] = leaves[i].frequency;
+
+	size_t leaf = 0, node = n;
+	auto pick = [&](size_t next)
+	{
+		if (leaf < n && (node >= next || weight[leaf] <= weight[node]))
+			return leaf++;
+		return node++;
+	};
+	for (size_t next = n; next < 2 * n - 1; ++next)
 	{
-		auto newcode = current_code;
-		newcode.push_back(false);
-		TraverseTree(node->left, newcode, codes);
+		size_t a = pick(next);
+		size_t b = pick(next);
+		weight[next] = weight[a] + weight[b];
+		parent[a] = parent[b] = static_cast<uint32_t>(next);
 	}
-	if (node->right != nullptr)
+
+	// Parents always follow their children, so walking backwards turns
+	// parent indices into depths in place
+	parent[2 * n - 2] = 0;
+	for (size_t i = 2 * n - 2; i-- > 0; )
+		parent[i] = parent[parent[i]] + 1;
+
+	uint32_t max_depth = 0;
+	for (size_t i = 0; i < n; ++i)
 	{
-		auto newcode = current_code;
-		newcode.push_back(true);
-		TraverseTree(node->right, newcode, codes);
+		cost.unconstrained_bits += leaves[i].frequency * parent[i];
+		max_depth = std::max(max_depth, parent[i]);
 	}
-	if (node->left == nullptr && node->right == nullptr)
+
+	if (max_length != 0 && max_depth > max_length)
+	{
+		auto& count = arena.length_count;
+		count.assign(max_depth + 1, 0);
+		for (size_t i = 0; i < n; ++i)
+			count[parent[i]]++;
+		LimitLengthCounts(count, max_length);
+		// least frequent leaves come first and take the longest codes
+		size_t i = 0;
+		for (uint32_t length = max_length; length > 0; --length)
+		{
+			for (uint32_t k = 0; k < count[length]; ++k)
+				parent[i++] = length;
+		}
+	}
+
+	lengths.reserve(n);
+	for (size_t i = 0; i < n; ++i)
 	{
-		node->code = current_code;
-		codes[node->value] = current_code;
+		lengths.push_back({leaves[i].value, parent[i]});
+		cost.bits += leaves[i].frequency * parent[i];
 #ifdef VERBOSE_DEBUG
-		std::string code_string;
-		for(auto i : current_code)
-			code_string += i ? "1" : "0";
-		std::cout << node->value << " " << node->frequency << " " << code_string << std::endl;
+		std::cout << +leaves[i].value << " " << leaves[i].frequency << " " << parent[i] << std::endl;
 #endif
 	}
+	return cost;
 }
 
-HTDistionary MakeHuffmanDictionary(HTNptr root)
+template<HuffmanSymbol Symbol>
+BasicHTDistionary<Symbol>::BasicHTDistionary(std::vector<BasicSymbolLength<Symbol>> symbol_lengths)
 {
-	HTDistionary codes;
-	TraverseTree(root, std::vector<bool>{}, codes);
-	return codes;
+	if (symbol_lengths.empty())
+		return;
+	std::sort(symbol_lengths.begin(), symbol_lengths.end(), [](const auto& lhs, const auto& rhs)
+	{
+		if (lhs.length == rhs.length)
+			return lhs.value < rhs.value;
+		return lhs.length < rhs.length;
+	});
+	if (symbol_lengths.back().length > WORD_BITS)
+		throw std::length_error("Huffman code is longer than 64 bits");
+
+	symbols.reserve(symbol_lengths.size());
+	lengths.reserve(symbol_lengths.size());
+	Symbol max_value = symbol_lengths.front().value;
+	min_value = max_value;
+	for (const auto& [value, length] : symbol_lengths)
+	{
+		symbols.push_back(value);
+		lengths.push_back(static_cast<uint8_t>(length));
+		min_value = std::min(min_value, value);
+		max_value = std::max(max_value, value);
+	}
+
+	// Small value ranges are looked up by index, everything else by hash
+	size_t range = HistogramRange(min_value, max_value);
+	bool use_dense = SMALL_ALPHABET<Symbol> || range <= std::max<size_t>(1 << 10, 8 * symbols.size());
+	if constexpr (!FIXED_TABLE)
+	{
+		if (use_dense)
+			dense.resize(range);
+	}
+
+	uint64_t code = 0;
+	uint32_t prev_length = lengths.front();
+	for (size_t i = 0; i < symbols.size(); ++i)
+	{
+		if (i != 0)
+		{
+			code = (code + 1) << (lengths[i] - prev_length);
+			prev_length = lengths[i];
+		}
+		HuffmanCode entry{code, lengths[i], static_cast<uint32_t>(i)};
+		if constexpr (FIXED_TABLE)
+			dense[static_cast<uint8_t>(symbols[i])] = entry;
+		else if (use_dense)
+			dense[HistogramBin(symbols[i], min_value)] = entry;
+		else
+			sparse.emplace(symbols[i], entry);
+	}
 }
 
-size_t DetermineThreads(size_t length)
+template<HuffmanSymbol Symbol>
+BasicHuffmanDecoder<Symbol>::BasicHuffmanDecoder(const BasicHTDistionary<Symbol>& dictionary,
+												 const Symbol* escape)
+	: primary(size_t{1} << PRIMARY_BITS)
+	, long_prefix(size_t{1} << PRIMARY_BITS)
+	, symbols(dictionary.symbols)
+	, max_length(dictionary.MaxLength())
 {
-	const size_t min_per_thread = MIN_LENGTH;
-	size_t max_threads = length / min_per_thread;
-	size_t hardware_conc = std::thread::hardware_concurrency();
-	return std::min(hardware_conc != 0 ? hardware_conc : 1, max_threads);
+	first_code.assign(max_length + 1, 0);
+	count.assign(max_length + 1, 0);
+	first_index.assign(max_length + 1, 0);
+	for (auto length : dictionary.lengths)
+		count[length]++;
+	uint64_t code = 0;
+	size_t index = 0;
+	for (uint32_t length = 1; length <= max_length; ++length)
+	{
+		first_code[length] = code;
+		first_index[length] = index;
+		code = (code + count[length]) << 1;
+		index += count[length];
+	}
+
+	// Short codes fill every primary slot that starts with them
+	std::vector<uint64_t> codes(symbols.size());
+	for (size_t i = 0; i < symbols.size(); ++i)
+	{
+		uint32_t length = dictionary.lengths[i];
+		codes[i] = first_code[length] + (i - first_index[length]);
+		if (length > PRIMARY_BITS)
+			continue;
+		unsigned free_bits = PRIMARY_BITS - length;
+		size_t first = codes[i] << free_bits;
+		for (size_t slot = first; slot < first + (size_t{1} << free_bits); ++slot)
+		{
+			auto& entry = primary[slot];
+			entry.symbol[0] = symbols[i];
+			entry.length = entry.first_length = static_cast<uint8_t>(length);
+			entry.count = 1;
+		}
+	}
+
+	// Long codes sharing a primary prefix get one secondary table sized by
+	// the longest of them
+	for (size_t i = 0; i < symbols.size(); )
+	{
+		uint32_t length = dictionary.lengths[i];
+		if (length <= PRIMARY_BITS)
+		{
+			++i;
+			continue;
+		}
+		size_t prefix = codes[i] >> (length - PRIMARY_BITS);
+		size_t last = i;
+		while (last < symbols.size() && (codes[last] >> (dictionary.lengths[last] - PRIMARY_BITS)) == prefix)
+			++last;
+		unsigned bits = dictionary.lengths[last - 1] - PRIMARY_BITS;
+		if (bits <= MAX_SECONDARY_BITS)
+		{
+			long_prefix[prefix] = {static_cast<uint32_t>(secondary.size()), static_cast<uint8_t>(bits)};
+			secondary.resize(secondary.size() + (size_t{1} << bits));
+			auto table = secondary.end() - (size_t{1} << bits);
+			for (size_t k = i; k < last; ++k)
+			{
+				unsigned sub_length = dictionary.lengths[k] - PRIMARY_BITS;
+				size_t sub_code = codes[k] & ((uint64_t{1} << sub_length) - 1);
+				size_t first = sub_code << (bits - sub_length);
+				for (size_t slot = first; slot < first + (size_t{1} << (bits - sub_length)); ++slot)
+					table[slot] = {symbols[k], static_cast<uint8_t>(dictionary.lengths[k])};
+			}
+		}
+		i = last;
+	}
+
+	// Pair a short code with the code that follows it when both fit into
+	// the primary index
+	std::vector<Entry> single = primary;
+	for (size_t slot = 0; slot < primary.size(); ++slot)
+	{
+		auto& entry = primary[slot];
+		if (entry.count != 1 || entry.length >= PRIMARY_BITS)
+			continue;
+		size_t next_slot = (slot << entry.length) & (primary.size() - 1);
+		const auto& next = single[next_slot];
+		bool unpaired = escape != nullptr && (entry.symbol[0] == *escape || next.symbol[0] == *escape);
+		if (next.count == 1 && entry.length + next.length <= PRIMARY_BITS && !unpaired)
+		{
+			entry.symbol[1] = next.symbol[0];
+			entry.length += next.length;
+			entry.count = 2;
+		}
+	}
 }
 
+template<HuffmanSymbol Symbol>
+const Symbol* BasicHuffmanDecoder<Symbol>::DecodeLong(uint64_t window, uint32_t& length) const
+{
+	const auto& prefix = long_prefix[window >> (WORD_BITS - PRIMARY_BITS)];
+	if (prefix.bits != 0)
+	{
+		unsigned bits = prefix.bits;
+		const auto& sub = secondary[prefix.offset + ((window << PRIMARY_BITS) >> (WORD_BITS - bits))];
+		length = sub.length;
+		if (length == 0)
+			throw std::runtime_error("Invalid Huffman code");
+		return &sub.symbol;
+	}
+	for (length = PRIMARY_BITS + 1; length <= max_length; ++length)
+	{
+		uint64_t code = window >> (WORD_BITS - length);
+		if (code - first_code[length] < count[length])
+			return &symbols[first_index[length] + (code - first_code[length])];
+	}
+	throw std::runtime_error("Invalid Huffman code");
+}
+
+template<HuffmanSymbol Symbol>
+size_t BasicHuffmanDecoder<Symbol>::Decode(const uint64_t* words, size_t word_count, size_t bit_offset,
+										   Symbol* out, size_t symbol_count) const
+{
+	if (symbol_count == 0)
+		return bit_offset;
+	if (max_length == 0)
+		throw std::runtime_error("Empty Huffman dictionary");
+
+	constexpr unsigned LOOKUPS = 4; // 4 * PRIMARY_BITS bits fit into one window
+	static_assert(LOOKUPS * PRIMARY_BITS <= WORD_BITS);
+	Symbol* end = out + symbol_count;
+	while (end - out >= static_cast<ptrdiff_t>(2 * LOOKUPS))
+	{
+		uint64_t window = PeekBits(words, word_count, bit_offset);
+		unsigned used = 0;
+		unsigned lookup = 0;
+		for (; lookup < LOOKUPS; ++lookup)
+		{
+			const auto& entry = primary[(window << used) >> (WORD_BITS - PRIMARY_BITS)];
+			if (entry.count == 0)
+				break;
+			out[0] = entry.symbol[0];
+			out[1] = entry.symbol[1];
+			out += entry.count;
+			used += entry.length;
+		}
+		bit_offset += used;
+		if (lookup != LOOKUPS)
+		{
+			uint32_t length;
+			*out++ = *DecodeLong(PeekBits(words, word_count, bit_offset), length);
+			bit_offset += length;
+		}
+	}
+	while (out != end)
+	{
+		uint64_t window = PeekBits(words, word_count, bit_offset);
+		const auto& entry = primary[window >> (WORD_BITS - PRIMARY_BITS)];
+		if (entry.count == 0)
+		{
+			uint32_t length;
+			*out++ = *DecodeLong(window, length);
+			bit_offset += length;
+		}
+		else
+		{
+			*out++ = entry.symbol[0];
+			bit_offset += entry.first_length;
+		}
+	}
+	return bit_offset;
+}
+
+template<HuffmanSymbol Symbol>
+size_t BasicHuffmanDecoder<Symbol>::DecodeEscaped(const uint64_t* words, size_t word_count, size_t bit_offset,
+												  Symbol* out, size_t symbol_count, Symbol escape) const
+{
+	if (symbol_count == 0)
+		return bit_offset;
+	if (max_length == 0)
+		throw std::runtime_error("Empty Huffman dictionary");
+
+	Symbol* end = out + symbol_count;
+	while (out != end)
+	{
+		uint64_t window = PeekBits(words, word_count, bit_offset);
+		const auto& entry = primary[window >> (WORD_BITS - PRIMARY_BITS)];
+		if (entry.count == 2 && end - out >= 2)
+		{
+			out[0] = entry.symbol[0];
+			out[1] = entry.symbol[1];
+			out += 2;
+			bit_offset += entry.length;
+			continue;
+		}
+		Symbol symbol;
+		if (entry.count == 0)
+		{
+			uint32_t length;
+			symbol = *DecodeLong(window, length);
+			bit_offset += length;
+		}
+		else
+		{
+			symbol = entry.symbol[0];
+			bit_offset += entry.first_length;
+		}
+		if (symbol == escape)
+		{
+			uint64_t raw = PeekBits(words, word_count, bit_offset) >> (WORD_BITS - ESCAPE_BITS);
+			symbol = static_cast<Symbol>(static_cast<std::make_unsigned_t<Symbol>>(raw));
+			bit_offset += ESCAPE_BITS;
+		}
+		*out++ = symbol;
+	}
+	return bit_offset;
+}
+
+template<HuffmanSymbol Symbol>
+template<unsigned STREAMS>
+void BasicHuffmanDecoder<Symbol>::DecodeStreams(const uint64_t* words, size_t word_count, Symbol* out,
+												size_t symbol_count) const
+{
+	size_t header = StreamHeaderWords(STREAMS);
+	if (header > word_count)
+		throw std::runtime_error("Huffman sub-stream header is truncated");
+	size_t offset[STREAMS];
+	offset[0] = header * WORD_BITS;
+	for (unsigned s = 1; s < STREAMS; ++s)
+	{
+		size_t start = header + static_cast<uint32_t>(words[(s - 1) / 2] >> (32 * ((s - 1) % 2)));
+		if (start > word_count)
+			throw std::runtime_error("Huffman sub-stream offset is out of range");
+		offset[s] = start * WORD_BITS;
+	}
+
+	auto step = [&](unsigned s, Symbol* target)
+	{
+		uint64_t window = PeekBits(words, word_count, offset[s]);
+		const auto& entry = primary[window >> (WORD_BITS - PRIMARY_BITS)];
+		if (entry.count != 0)
+		{
+			*target = entry.symbol[0];
+			offset[s] += entry.first_length;
+		}
+		else
+		{
+			uint32_t length;
+			*target = *DecodeLong(window, length);
+			offset[s] += length;
+		}
+	};
+
+	// Each round takes two symbols from every stream, the streams being
+	// independent chains the CPU can overlap
+	Symbol* end = out + symbol_count;
+	for (; end - out >= static_cast<ptrdiff_t>(2 * STREAMS); out += 2 * STREAMS)
+	{
+		for (unsigned s = 0; s < STREAMS; ++s)
+		{
+			uint64_t window = PeekBits(words, word_count, offset[s]);
+			const auto& first = primary[window >> (WORD_BITS - PRIMARY_BITS)];
+			if (first.count == 2)
+			{
+				out[s] = first.symbol[0];
+				out[STREAMS + s] = first.symbol[1];
+				offset[s] += first.length;
+				continue;
+			}
+			if (first.count == 1)
+			{
+				const auto& second = primary[(window << first.length) >> (WORD_BITS - PRIMARY_BITS)];
+				if (second.count != 0)
+				{
+					out[s] = first.symbol[0];
+					out[STREAMS + s] = second.symbol[0];
+					offset[s] += first.length + second.first_length;
+					continue;
+				}
+			}
+			step(s, out + s);
+			step(s, out + STREAMS + s);
+		}
+	}
+	for (unsigned s = 0; out != end; ++out, s = s + 1 == STREAMS ? 0 : s + 1)
+		step(s, out);
+}
+
+template<HuffmanSymbol Symbol>
+void BasicHuffmanDecoder<Symbol>::DecodeStreams(const uint64_t* words, size_t word_count, unsigned streams,
+												Symbol* out, size_t symbol_count) const
+{
+	if (symbol_count == 0)
+		return;
+	if (max_length == 0)
+		throw std::runtime_error("Empty Huffman dictionary");
+	switch (streams)
+	{
+	case 1:
+		Decode(words, word_count, 0, out, symbol_count);
+		break;
+	case 2:
+		DecodeStreams<2>(words, word_count, out, symbol_count);
+		break;
+	case 4:
+		DecodeStreams<4>(words, word_count, out, symbol_count);
+		break;
+	case 8:
+		DecodeStreams<8>(words, word_count, out, symbol_count);
+		break;
+	default:
+		throw std::invalid_argument("Unsupported Huffman sub-stream count");
+	}
+}
+
+// The supported symbol types, see HuffmanSymbol
+template CodeCost MakeCodeLengths(const BasicHTFrequency<uint8_t>&, BasicHuffmanArena<uint8_t>&,
+								   std::vector<BasicSymbolLength<uint8_t>>&, uint32_t);
+template class BasicHTDistionary<uint8_t>;
+template class BasicHuffmanDecoder<uint8_t>;
+
+template CodeCost MakeCodeLengths(const BasicHTFrequency<int8_t>&, BasicHuffmanArena<int8_t>&,
+								   std::vector<BasicSymbolLength<int8_t>>&, uint32_t);
+template class BasicHTDistionary<int8_t>;
+template class BasicHuffmanDecoder<int8_t>;
+
+template CodeCost MakeCodeLengths(const BasicHTFrequency<uint16_t>&, BasicHuffmanArena<uint16_t>&,
+								   std::vector<BasicSymbolLength<uint16_t>>&, uint32_t);
+template class BasicHTDistionary<uint16_t>;
+template class BasicHuffmanDecoder<uint16_t>;
+
+template CodeCost MakeCodeLengths(const BasicHTFrequency<int16_t>&, BasicHuffmanArena<int16_t>&,
+								   std::vector<BasicSymbolLength<int16_t>>&, uint32_t);
+template class BasicHTDistionary<int16_t>;
+template class BasicHuffmanDecoder<int16_t>;
+
+template CodeCost MakeCodeLengths(const BasicHTFrequency<int32_t>&, BasicHuffmanArena<int32_t>&,
+								   std::vector<BasicSymbolLength<int32_t>>&, uint32_t);
+template class BasicHTDistionary<int32_t>;
+template class BasicHuffmanDecoder<int32_t>;
+
+template CodeCost MakeCodeLengths(const BasicHTFrequency<int64_t>&, BasicHuffmanArena<int64_t>&,
+								   std::vector<BasicSymbolLength<int64_t>>&, uint32_t);
+template class BasicHTDistionary<int64_t>;
+template class BasicHuffmanDecoder<int64_t>;
+
 }
@@ -5,172 +5,405 @@
 #define HUFFMANTREE_H
 
 #include <unordered_map>
-#include <memory>
+#include <algorithm>
+#include <array>
+#include <iterator>
+#include <type_traits>
+#include <stdexcept>
+#include <cstdint>
 #include <vector>
-#include <queue>
 #include <cassert>
-#include <thread>
-#include <future>
+#include "bitstream.h"
+#include "frequency.h"
+#include "threadpool.h"
 
 namespace HuffmanTree
 {
 
-struct HuffmanTreeNode
+struct HuffmanCode
 {
-	int value{0};
-	int frequency{0};
-	std::vector<bool> code{};
+	uint64_t bits{0};
+	uint32_t length{0};
+	uint32_t index{0};      // position of the symbol in canonical order
+};
+
+template<HuffmanSymbol Symbol>
+struct BasicSymbolLength
+{
+	Symbol value;
+	uint32_t length;
+};
+
+using SymbolLength = BasicSymbolLength<int>;
+
+// Canonical Huffman codes: symbols ordered by (code length, value) get
+// consecutive codes, so the whole table follows from the code lengths.
+// Bytes are looked up in a fixed table over the whole alphabet, 16-bit
+// symbols in a flat table over their range and wider symbols by index or
+// by hash depending on how sparse their range is.
+template<HuffmanSymbol Symbol>
+class BasicHTDistionary
+{
+	static constexpr bool FIXED_TABLE = sizeof(Symbol) == 1;
 
-	using NodePointer = std::shared_ptr<HuffmanTreeNode>;
-	NodePointer left{nullptr}, right{nullptr};
+	Symbol min_value{0};
+	std::conditional_t<FIXED_TABLE, std::array<HuffmanCode, 256>, std::vector<HuffmanCode>> dense{};
+	std::unordered_map<Symbol, HuffmanCode> sparse;
 
-	HuffmanTreeNode() = default;
-	HuffmanTreeNode(int value, int frequency)
-		: value{value}, frequency{frequency}
-	{}
-	bool IsLeaf() const
+public:
+	std::vector<Symbol> symbols;    // canonical order
+	std::vector<uint8_t> lengths;   // lengths[i] is the code length of symbols[i]
+
+	BasicHTDistionary() = default;
+	explicit BasicHTDistionary(std::vector<BasicSymbolLength<Symbol>> symbol_lengths);
+
+	bool empty() const
 	{
-		return left == nullptr && right == nullptr;
+		return symbols.empty();
+	}
+
+	uint32_t MaxLength() const
+	{
+		return lengths.empty() ? 0 : lengths.back();
+	}
+
+	// nullptr when the value has no code
+	const HuffmanCode* Find(Symbol value) const
+	{
+		if constexpr (FIXED_TABLE)
+		{
+			const auto& code = dense[static_cast<uint8_t>(value)];
+			return code.length != 0 ? &code : nullptr;
+		}
+		else
+		{
+			if (!dense.empty())
+			{
+				size_t index = HistogramBin(value, min_value);
+				if (index >= dense.size() || dense[index].length == 0)
+					return nullptr;
+				return &dense[index];
+			}
+			auto it = sparse.find(value);
+			return it != sparse.end() ? &it->second : nullptr;
+		}
+	}
+
+	const HuffmanCode& Code(Symbol value) const
+	{
+		auto code = Find(value);
+		if (code == nullptr)
+			throw std::out_of_range("Symbol is not in the dictionary");
+		return *code;
 	}
 };
 
-using HTNptr = HuffmanTreeNode::NodePointer;
-using HTDistionary = std::unordered_map<int, std::vector<bool>>;
+using HTDistionary = BasicHTDistionary<int>;
 
-bool operator <(const HTNptr& lhs, const HTNptr& rhs);
-bool operator >(const HTNptr& lhs, const HTNptr& rhs);
+// Whether length_count[l - 1] codes of every length l meet the Kraft
+// inequality, so that every canonical code fits its length. Lengths read
+// from a file must pass it before a decoder is built from them.
+bool IsPrefixCode(const std::vector<uint32_t>& length_count);
 
-void TraverseTree(HTNptr node, std::vector<bool> current_code, HTDistionary& codes);
+// Scratch space of the tree build, reusable across builds so that
+// compressing many small blocks does not allocate per tree
+template<HuffmanSymbol Symbol>
+struct BasicHuffmanArena
+{
+	std::vector<BasicSymbolFrequency<Symbol>> leaves;
+	std::vector<uint64_t> weight;
+	std::vector<uint32_t> parent;
+	std::vector<uint32_t> length_count;
+};
 
-HTDistionary MakeHuffmanDictionary(HTNptr root);
+using HuffmanArena = BasicHuffmanArena<int>;
+
+// Encoded size of the frequencies with the chosen code lengths, next to the
+// size with unconstrained Huffman lengths
+struct CodeCost
+{
+	uint64_t bits{0};
+	uint64_t unconstrained_bits{0};
+
+	// Relative size increase paid for the length limit
+	double Overhead() const
+	{
+		return unconstrained_bits != 0 ? double(bits) / unconstrained_bits - 1.0 : 0.0;
+	}
+};
+
+// Code lengths of an optimal prefix code for the given frequencies. A
+// non-zero max_length limits the code lengths: overlong codes are clamped
+// and the Kraft sum is restored by moving shorter codes one level down,
+// after which the lengths are dealt out again by frequency.
+template<HuffmanSymbol Symbol>
+CodeCost MakeCodeLengths(const BasicHTFrequency<Symbol>& frequency, BasicHuffmanArena<Symbol>& arena,
+						 std::vector<BasicSymbolLength<Symbol>>& lengths, uint32_t max_length = 0);
+
+template<HuffmanSymbol Symbol>
+std::vector<BasicSymbolLength<Symbol>> MakeCodeLengths(const BasicHTFrequency<Symbol>& frequency,
+													   uint32_t max_length = 0)
+{
+	BasicHuffmanArena<Symbol> arena;
+	std::vector<BasicSymbolLength<Symbol>> lengths;
+	MakeCodeLengths(frequency, arena, lengths, max_length);
+	return lengths;
+}
+
+template<HuffmanSymbol Symbol>
+BasicHTDistionary<Symbol> MakeHuffmanDictionary(const BasicHTFrequency<Symbol>& frequency,
+												uint32_t max_length = 0, CodeCost* cost = nullptr)
+{
+	BasicHuffmanArena<Symbol> arena;
+	std::vector<BasicSymbolLength<Symbol>> lengths;
+	auto code_cost = MakeCodeLengths(frequency, arena, lengths, max_length);
+	if (cost != nullptr)
+		*cost = code_cost;
+	return BasicHTDistionary<Symbol>(std::move(lengths));
+}
 
 template<typename It>
-std::unordered_map<int, int> MakeHuffmanFrequency(It first, It last)
+auto MakeHuffmanDictionary(It first, It last, ThreadPool& pool = ThreadPool::Default())
 {
-	std::unordered_map<int, int> frequency_dictionary;
+	return MakeHuffmanDictionary(MakeHuffmanFrequency(first, last, pool));
+}
+
+// Exact number of bits HuffmanEncode writes for the range
+template<typename It, typename Symbol>
+size_t EncodedBits(It first, It last, const BasicHTDistionary<Symbol>& dictionary)
+{
+	size_t bits = 0;
 	for (It it = first; it != last; ++it)
-		frequency_dictionary[*it]++;
-	return frequency_dictionary;
+		bits += dictionary.Code(*it).length;
+	return bits;
 }
 
-template<typename It>
-HTNptr MakeHuffmanTree(It first, It last)
+// out must have room for WordCount(EncodedBits(first, last, dictionary)) words
+template<typename It, typename Symbol>
+void HuffmanEncode(It first, It last, const BasicHTDistionary<Symbol>& dictionary, uint64_t* out)
 {
-	auto frequency = MakeHuffmanFrequency(first, last);
-	std::priority_queue<HTNptr, std::vector<HTNptr>, std::greater<HTNptr>> queue;
-	for (auto [value, frequency] : frequency)
+	BitWriter writer(out);
+	for (It it = first; it != last; ++it)
 	{
-		if (frequency != 0)
-			queue.push(std::make_shared<HuffmanTreeNode>(value, frequency));
-	}
-	while (queue.size() > 1)
-	{
-		auto l = queue.top();
-		queue.pop();
-		auto r = queue.top();
-		queue.pop();
-		auto p = std::make_shared<HuffmanTreeNode>(0, l->frequency + r->frequency);
-		p->left = l;
-		p->right = r;
-		queue.push(p);
+		const auto& code = dictionary.Code(*it);
+		writer.Write(code.bits, code.length);
 	}
-	auto root = queue.top();
-	queue.pop();
-	assert(queue.empty());
-	return root;
+	writer.Flush();
 }
 
-template<typename It>
-std::vector<bool> HuffmanCompress(It first, It last, const HTDistionary& dictionary)
+template<typename It, typename Symbol>
+BitStream HuffmanCompress(It first, It last, const BasicHTDistionary<Symbol>& dictionary)
 {
-	std::vector<bool> result;
-	result.reserve(std::distance(first, last));
-	for (It it = first; it!= last; ++it)
-	{
-		const auto& code = dictionary.at(*it);
-		result.insert(result.end(), code.cbegin(), code.cend());
-	}
-	result.shrink_to_fit();
+	BitStream result;
+	result.bits = EncodedBits(first, last, dictionary);
+	result.words.resize(WordCount(result.bits));
+	HuffmanEncode(first, last, dictionary, result.words.data());
 	return result;
 }
 
-constexpr size_t MIN_LENGTH = 100;
-size_t DetermineThreads(size_t length);
+constexpr size_t DEFAULT_BLOCK_SIZE = size_t{1} << 16;
 
-template<typename It>
-std::vector<bool> HuffmanCompressParallel(It first, It last, const HTDistionary& dictionary)
-{
-	size_t length = std::distance(first, last);
-	if (length < MIN_LENGTH)
-		return HuffmanCompress(first, last, dictionary);
+// A block can be split into interleaved sub-streams, symbol i going to
+// stream i % streams, so that the decoder follows several independent bit
+// positions at once. Every stream starts on a word boundary; the block opens
+// with the word offsets of streams 1.. as 32-bit halves of
+// StreamHeaderWords words, counted from the end of the header. One stream
+// is the plain single-stream layout.
+constexpr unsigned MAX_STREAMS = 8;
 
-	size_t nthreads = DetermineThreads(length);
-	size_t bsize = length / nthreads;
+inline bool ValidStreamCount(unsigned streams)
+{
+	return streams >= 1 && streams <= MAX_STREAMS && (streams & (streams - 1)) == 0;
+}
 
-	std::vector<std::future<std::vector<bool>>> results(nthreads);
+inline size_t StreamHeaderWords(unsigned streams)
+{
+	return streams / 2;
+}
 
-	auto compress_bloc = [&](auto first, auto last)
+// Code bits of every sub-stream of the block
+template<std::random_access_iterator It, typename Symbol>
+void StreamBits(It first, size_t count, const BasicHTDistionary<Symbol>& dictionary, unsigned streams,
+				size_t* bits)
+{
+	std::fill(bits, bits + streams, 0);
+	for (size_t i = 0, s = 0; i < count; ++i)
 	{
-		return HuffmanCompress(first, last, dictionary);
-	};
+		bits[s] += dictionary.Code(first[i]).length;
+		s = s + 1 == streams ? 0 : s + 1;
+	}
+}
 
-	size_t tidx = 0;
-	for (; length >= bsize * (tidx + 1); first += bsize, tidx += 1)
+// Bits of the whole block: header, word-aligned streams, the last stream
+inline size_t StreamedBlockBits(const size_t* bits, unsigned streams)
+{
+	size_t words = StreamHeaderWords(streams);
+	for (unsigned s = 0; s + 1 < streams; ++s)
+		words += WordCount(bits[s]);
+	return words * WORD_BITS + bits[streams - 1];
+}
+
+// out must have room for WordCount(StreamedBlockBits(bits, streams)) words
+template<std::random_access_iterator It, typename Symbol>
+void HuffmanEncodeStreams(It first, size_t count, const BasicHTDistionary<Symbol>& dictionary,
+						  unsigned streams, const size_t* bits, uint64_t* out)
+{
+	size_t header = StreamHeaderWords(streams);
+	std::fill(out, out + header, 0);
+	size_t offset = header;
+	for (unsigned s = 0; s < streams; ++s)
 	{
-		std::packaged_task<std::vector<bool>(It, It)> task{compress_bloc};
-		results[tidx] = task.get_future();
-		std::thread t{std::move(task), first, first + bsize};
-		t.detach();
+		if (s != 0)
+			out[(s - 1) / 2] |= uint64_t{static_cast<uint32_t>(offset - header)} << (32 * ((s - 1) % 2));
+		BitWriter writer(out + offset);
+		for (size_t i = s; i < count; i += streams)
+		{
+			const auto& code = dictionary.Code(first[i]);
+			writer.Write(code.bits, code.length);
+		}
+		writer.Flush();
+		offset += WordCount(bits[s]);
 	}
+}
+
+// Every block is sized first, so a prefix sum gives each block its word
+// offset in one preallocated buffer and the workers encode straight into it
+template<std::random_access_iterator It, typename Symbol>
+BlockStream HuffmanCompressBlocks(It first, It last, const BasicHTDistionary<Symbol>& dictionary,
+								  size_t block_size, ThreadPool& pool)
+{
+	size_t length = std::distance(first, last);
+	block_size = std::max<size_t>(block_size, 1);
+	size_t nblocks = (length + block_size - 1) / block_size;
 
-	std::vector<bool> result;
-	for (size_t i = 0; i < nthreads; ++i)
+	BlockStream result;
+	result.blocks.resize(nblocks);
+	std::vector<size_t> bits(nblocks);
+	pool.ParallelFor(nblocks, [&](size_t i)
 	{
-		auto res = results[i].get();
-		result.insert(result.end(), res.cbegin(), res.cend());
-	}
+		size_t n = std::min(block_size, length - i * block_size);
+		auto begin = first + i * block_size;
+		bits[i] = EncodedBits(begin, begin + n, dictionary);
+		result.blocks[i].symbol_count = n;
+	});
 
-	auto remainder = length - bsize * tidx;
-	if (remainder > 0)
+	size_t offset = 0;
+	for (size_t i = 0; i < nblocks; ++i)
 	{
-		auto res = compress_bloc(first, first + remainder);
-		result.insert(result.end(), res.cbegin(), res.cend());
+		result.blocks[i].bit_offset = offset;
+		offset += WordCount(bits[i]) * WORD_BITS;
 	}
+	result.data.words.resize(offset / WORD_BITS);
+	result.data.bits = nblocks != 0 ? result.blocks.back().bit_offset + bits.back() : 0;
+
+	pool.ParallelFor(nblocks, [&](size_t i)
+	{
+		auto begin = first + i * block_size;
+		HuffmanEncode(begin, begin + result.blocks[i].symbol_count, dictionary,
+					  result.data.words.data() + result.blocks[i].bit_offset / WORD_BITS);
+	});
 	return result;
 }
 
-template<typename It>
-std::vector<int> HuffmanDecompress(It first, It last, HTNptr root)
+// Table-driven decoder. The primary table is indexed by the next
+// PRIMARY_BITS bits of the stream and resolves one or two symbols per lookup.
+// Longer codes go through a second-level table per primary prefix, and codes
+// too long even for that are found by a canonical search over code lengths.
+// The primary entries hold the symbols themselves, so narrow symbols keep
+// the table small.
+template<HuffmanSymbol Symbol>
+class BasicHuffmanDecoder
 {
-	std::vector<int> result;
-	auto node = root;
-	for (It it = first; it != last; ++it)
+public:
+	static constexpr unsigned PRIMARY_BITS = 11;
+	static constexpr unsigned MAX_SECONDARY_BITS = 10;
+	// width of the raw value that follows an escape symbol
+	static constexpr unsigned ESCAPE_BITS = 8 * sizeof(Symbol);
+
+	BasicHuffmanDecoder() = default;
+	// escape, when given, is never paired with another symbol in the
+	// primary table so that DecodeEscaped can spot it
+	explicit BasicHuffmanDecoder(const BasicHTDistionary<Symbol>& dictionary, const Symbol* escape = nullptr);
+
+	// Decodes symbol_count symbols starting at bit_offset into out and
+	// returns the bit offset after the last one.
+	size_t Decode(const uint64_t* words, size_t word_count, size_t bit_offset,
+				  Symbol* out, size_t symbol_count) const;
+
+	// Like Decode, but the escape symbol is followed by the raw ESCAPE_BITS
+	// value that replaces it
+	size_t DecodeEscaped(const uint64_t* words, size_t word_count, size_t bit_offset,
+						 Symbol* out, size_t symbol_count, Symbol escape) const;
+
+	// Decodes a block of interleaved sub-streams, see HuffmanEncodeStreams.
+	// words and word_count cover exactly the block.
+	void DecodeStreams(const uint64_t* words, size_t word_count, unsigned streams,
+					   Symbol* out, size_t symbol_count) const;
+
+private:
+	struct Entry
 	{
-		if (*it)
-		{
-			if (node->right != nullptr)
-			{
-				node = node->right;
-				if (node->IsLeaf())
-				{
-					result.push_back(node->value);
-					node = root;
-				}
-			}
-		}
-		else
-		{
-			if (node->left != nullptr)
-			{
-				node = node->left;
-				if (node->IsLeaf())
-				{
-					result.push_back(node->value);
-					node = root;
-				}
-			}
-		}
+		Symbol symbol[2]{0, 0};
+		uint8_t length{0};      // bits consumed by all decoded symbols
+		uint8_t first_length{0};
+		uint8_t count{0};       // 0 marks a long or invalid code
+	};
+	// Where the long codes of a primary prefix are resolved
+	struct LongPrefix
+	{
+		uint32_t offset{0};     // first entry of the secondary table
+		uint8_t bits{0};        // secondary index bits, 0 for the canonical search
+	};
+	struct SecondaryEntry
+	{
+		Symbol symbol{0};
+		uint8_t length{0};      // full code length, 0 for an invalid code
+	};
+
+	std::vector<Entry> primary;
+	std::vector<LongPrefix> long_prefix;
+	std::vector<SecondaryEntry> secondary;
+
+	// canonical search state for codes without a secondary table
+	std::vector<Symbol> symbols;
+	std::vector<uint64_t> first_code;
+	std::vector<uint64_t> count;
+	std::vector<size_t> first_index;
+	uint32_t max_length{0};
+
+	const Symbol* DecodeLong(uint64_t window, uint32_t& length) const;
+
+	template<unsigned STREAMS>
+	void DecodeStreams(const uint64_t* words, size_t word_count, Symbol* out, size_t symbol_count) const;
+};
+
+using HuffmanDecoder = BasicHuffmanDecoder<int>;
+
+// Decodes the blocks on the pool, each straight into its place in the output.
+// Only single-stream blocks of the global table are understood; throws
+// std::invalid_argument on any other coder. Images of CompressedData, which
+// may mix coders, decode through CompressedData::Decompress.
+template<HuffmanSymbol Symbol>
+std::vector<Symbol> HuffmanDecompress(BlockStreamView data, const BasicHTDistionary<Symbol>& dictionary,
+									  ThreadPool& pool = ThreadPool::Serial())
+{
+	std::vector<size_t> positions(data.blocks.size());
+	size_t total = 0;
+	for (size_t i = 0; i < data.blocks.size(); ++i)
+	{
+		if (data.blocks[i].coder != BlockCoder::Huffman)
+			throw std::invalid_argument("Block is not coded with the global Huffman table");
+		positions[i] = total;
+		total += data.blocks[i].symbol_count;
 	}
+
+	std::vector<Symbol> result(total);
+	BasicHuffmanDecoder<Symbol> decoder(dictionary);
+	pool.ParallelFor(data.blocks.size(), [&](size_t i)
+	{
+		decoder.Decode(data.words.data(), data.words.size(), data.blocks[i].bit_offset,
+					   result.data() + positions[i], data.blocks[i].symbol_count);
+	});
 	return result;
 }
 
@@ -2,11 +2,24 @@
 // Licensed after GNU GPL v3
 
 #include <iostream>
+#include <algorithm>
+#include <chrono>
 #include <cassert>
 #include <thread>
 #include <random>
 #include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <memory>
+#include <queue>
+#include <list>
+#include <functional>
 #include "compressor.h"
+#include "fileformat.h"
+#include "streamcompressor.h"
+#include "shareddictionary.h"
+#include "pipeline.h"
 
 namespace
 {
@@ -15,12 +28,122 @@ std::vector<int> Generate(int min, int max, size_t size, int seed = 0)
 	std::vector<int> result(size);
 	std::mt19937 gen(seed);
 	std::uniform_int_distribution<> distrib(min, max);
-	std::transform(result.cbegin(), result.cend(), result.begin(), [&](auto i)
+	std::transform(result.cbegin(), result.cend(), result.begin(), [&](int)
 	{
 		return distrib(gen);
 	});
 	return result;
 }
+
+std::vector<int> GenerateGeometric(double p, size_t size, int seed = 0)
+{
+	std::vector<int> result(size);
+	std::mt19937 gen(seed);
+	std::geometric_distribution<> distrib(p);
+	for (auto& value : result)
+		value = distrib(gen);
+	return result;
+}
+
+// The encoder before canonical codes: one std::vector<bool> code per symbol
+// appended bit by bit, kept as the baseline for TestEncodeTime
+std::vector<bool> CompressBitwise(const std::vector<int>& sequence, const HTDistionary& dictionary)
+{
+	std::unordered_map<int, std::vector<bool>> codes;
+	for (size_t i = 0; i < dictionary.symbols.size(); ++i)
+	{
+		const auto& code = dictionary.Code(dictionary.symbols[i]);
+		std::vector<bool> bits(code.length);
+		for (uint32_t b = 0; b < code.length; ++b)
+			bits[b] = (code.bits >> (code.length - 1 - b)) & 1;
+		codes[dictionary.symbols[i]] = bits;
+	}
+	std::vector<bool> result;
+	result.reserve(sequence.size());
+	for (auto value : sequence)
+	{
+		const auto& code = codes.at(value);
+		result.insert(result.end(), code.cbegin(), code.cend());
+	}
+	result.shrink_to_fit();
+	return result;
+}
+
+// The pointer-based tree build, kept as the baseline for TestTreeTime
+struct TreeNode
+{
+	int value{0};
+	uint64_t frequency{0};
+	std::shared_ptr<TreeNode> left, right;
+};
+
+void TraverseTree(const std::shared_ptr<TreeNode>& node, uint32_t depth, std::vector<SymbolLength>& lengths)
+{
+	if (node->left == nullptr)
+	{
+		lengths.push_back({node->value, std::max(depth, 1u)});
+		return;
+	}
+	TraverseTree(node->left, depth + 1, lengths);
+	TraverseTree(node->right, depth + 1, lengths);
+}
+
+std::vector<SymbolLength> CodeLengthsSharedTree(const HTFrequency& frequency)
+{
+	using Node = std::shared_ptr<TreeNode>;
+	auto greater = [](const Node& lhs, const Node& rhs)
+	{
+		if (lhs->frequency == rhs->frequency)
+			return lhs->value > rhs->value;
+		return lhs->frequency > rhs->frequency;
+	};
+	std::priority_queue<Node, std::vector<Node>, decltype(greater)> queue(greater);
+	for (auto [value, count] : frequency)
+		queue.push(std::make_shared<TreeNode>(TreeNode{value, count, nullptr, nullptr}));
+	while (queue.size() > 1)
+	{
+		auto l = queue.top();
+		queue.pop();
+		auto r = queue.top();
+		queue.pop();
+		queue.push(std::make_shared<TreeNode>(TreeNode{0, l->frequency + r->frequency, l, r}));
+	}
+	std::vector<SymbolLength> lengths;
+	TraverseTree(queue.top(), 0, lengths);
+	return lengths;
+}
+
+// The bit-at-a-time canonical decoder, kept as the baseline for TestDecodeTime
+std::vector<int> DecompressBitwise(BlockStreamView data, const HTDistionary& dictionary)
+{
+	std::vector<int> result;
+	std::vector<uint64_t> count(dictionary.MaxLength() + 1, 0);
+	for (auto length : dictionary.lengths)
+		count[length]++;
+	for (const auto& block : data.blocks)
+	{
+		uint64_t code = 0, first = 0;
+		size_t index = 0;
+		uint32_t length = 1;
+		size_t end = result.size() + block.symbol_count;
+		for (size_t i = block.bit_offset; result.size() < end; ++i)
+		{
+			code |= (data.words[i / WORD_BITS] >> (WORD_BITS - 1 - i % WORD_BITS)) & 1;
+			if (code - first < count[length])
+			{
+				result.push_back(dictionary.symbols[index + (code - first)]);
+				code = first = index = 0;
+				length = 1;
+				continue;
+			}
+			index += count[length];
+			first = (first + count[length]) << 1;
+			code <<= 1;
+			++length;
+		}
+	}
+	return result;
+}
 }
 
 void Test1(int min, int max, size_t size)
@@ -43,6 +166,19 @@ void Test1(int min, int max, size_t size)
 		std::cout << "Decompressed sequense is wrong" << std::endl;
 }
 
+// Input without random access goes through a buffer
+void TestListInput(int min, int max, size_t size)
+{
+	auto sequence = Generate(min, max, size);
+	std::list<int> list(sequence.cbegin(), sequence.cend());
+	CompressedData compressed;
+	compressed.Compress(list.begin(), list.end());
+	if (compressed.Decompress() == sequence)
+		std::cout << "List input round trip is ok" << std::endl;
+	else
+		std::cout << "List input round trip is wrong" << std::endl;
+}
+
 void TestTime(int min, int max, size_t size)
 {
 	auto sequence = Generate(min, max, size);
@@ -77,6 +213,724 @@ void TestTime(int min, int max, size_t size)
 
 }
 
+void TestDecodeTime(int min, int max, size_t size)
+{
+	auto sequence = Generate(min, max, size);
+	// both decoders below read single-stream blocks of the global table only
+	CompressOptions options;
+	options.coder = EntropyCoder::Huffman;
+	options.streams = 1;
+	CompressedData compressed;
+	compressed.Compress(sequence.cbegin(), sequence.cend(), options);
+
+	auto start1 = std::chrono::high_resolution_clock::now();
+	auto bitwise = DecompressBitwise(compressed.Data(), compressed.Dictionary());
+	auto end1 = std::chrono::high_resolution_clock::now();
+	auto us1 = std::chrono::duration_cast<std::chrono::microseconds>(end1 - start1).count();
+	std::cout << "Decode bitwise takes " << us1 << " us, "
+			  << sequence.size() * sizeof(int) / (us1 + 1.0) << " MB/s" << std::endl;
+
+	auto start2 = std::chrono::high_resolution_clock::now();
+	auto table = HuffmanDecompress(compressed.Data(), compressed.Dictionary());
+	auto end2 = std::chrono::high_resolution_clock::now();
+	auto us2 = std::chrono::duration_cast<std::chrono::microseconds>(end2 - start2).count();
+	std::cout << "Decode table   takes " << us2 << " us, "
+			  << sequence.size() * sizeof(int) / (us2 + 1.0) << " MB/s" << std::endl;
+	std::cout << "Decode speedup: " << (double)us1 / us2 << std::endl;
+
+	auto start3 = std::chrono::high_resolution_clock::now();
+	auto parallel = compressed.Decompress();
+	auto end3 = std::chrono::high_resolution_clock::now();
+	auto us3 = std::chrono::duration_cast<std::chrono::microseconds>(end3 - start3).count();
+	std::cout << "Decode table parallel takes " << us3 << " us, "
+			  << sequence.size() * sizeof(int) / (us3 + 1.0) << " MB/s, "
+			  << compressed.Data().blocks.size() << " blocks" << std::endl;
+	std::cout << "Parallel decode speedup: " << (double)us2 / us3 << std::endl;
+
+	if (table == bitwise && table == sequence && parallel == sequence)
+		std::cout << "Table decoded sequense is ok" << std::endl;
+	else
+		std::cout << "Table decoded sequense is wrong" << std::endl;
+}
+
+void TestEncodeTime(int min, int max, size_t size)
+{
+	auto sequence = Generate(min, max, size);
+	auto dictionary = MakeHuffmanDictionary(sequence.cbegin(), sequence.cend());
+
+	auto start1 = std::chrono::high_resolution_clock::now();
+	auto bitwise = CompressBitwise(sequence, dictionary);
+	auto end1 = std::chrono::high_resolution_clock::now();
+	auto us1 = std::chrono::duration_cast<std::chrono::microseconds>(end1 - start1).count();
+	std::cout << "Encode vector<bool> takes " << us1 << " us" << std::endl;
+
+	auto start2 = std::chrono::high_resolution_clock::now();
+	auto packed = HuffmanCompress(sequence.cbegin(), sequence.cend(), dictionary);
+	auto end2 = std::chrono::high_resolution_clock::now();
+	auto us2 = std::chrono::duration_cast<std::chrono::microseconds>(end2 - start2).count();
+	std::cout << "Encode packed words takes " << us2 << " us" << std::endl;
+	std::cout << "Encode speedup: " << (double)us1 / us2 << std::endl;
+
+	bool same = bitwise.size() == packed.bits;
+	for (size_t i = 0; same && i < bitwise.size(); ++i)
+		same = bitwise[i] == static_cast<bool>((packed.words[i / WORD_BITS] >> (WORD_BITS - 1 - i % WORD_BITS)) & 1);
+	if (same)
+		std::cout << "Packed bitstream is ok" << std::endl;
+	else
+		std::cout << "Packed bitstream is wrong" << std::endl;
+}
+
+void TestFrequencyTime(int min, int max, size_t size)
+{
+	auto sequence = Generate(min, max, size);
+
+	auto start1 = std::chrono::high_resolution_clock::now();
+	std::unordered_map<int, int> hashed;
+	for (auto value : sequence)
+		hashed[value]++;
+	auto end1 = std::chrono::high_resolution_clock::now();
+	auto us1 = std::chrono::duration_cast<std::chrono::microseconds>(end1 - start1).count();
+	std::cout << "Count unordered_map takes " << us1 << " us" << std::endl;
+
+	auto start2 = std::chrono::high_resolution_clock::now();
+	auto frequency = MakeHuffmanFrequency(sequence.cbegin(), sequence.cend());
+	auto end2 = std::chrono::high_resolution_clock::now();
+	auto us2 = std::chrono::duration_cast<std::chrono::microseconds>(end2 - start2).count();
+	std::cout << "Count histograms    takes " << us2 << " us" << std::endl;
+	std::cout << "Count speedup: " << (double)us1 / us2 << std::endl;
+
+	bool same = frequency.size() == hashed.size();
+	for (const auto& [value, count] : frequency)
+		same = same && hashed[value] == static_cast<int>(count);
+	if (same)
+		std::cout << "Frequencies are ok" << std::endl;
+	else
+		std::cout << "Frequencies are wrong" << std::endl;
+}
+
+void TestTreeTime(int min, int max, size_t blocks, size_t block_size)
+{
+	auto sequence = Generate(min, max, blocks * block_size);
+	std::vector<HTFrequency> frequencies;
+	for (size_t i = 0; i < blocks; ++i)
+	{
+		auto first = sequence.cbegin() + i * block_size;
+		frequencies.push_back(MakeHuffmanFrequency(first, first + block_size));
+	}
+	auto cost = [](const HTFrequency& frequency, const std::vector<SymbolLength>& lengths)
+	{
+		std::unordered_map<int, uint32_t> length_of;
+		for (auto [value, length] : lengths)
+			length_of[value] = length;
+		uint64_t bits = 0;
+		for (auto [value, count] : frequency)
+			bits += count * length_of[value];
+		return bits;
+	};
+
+	std::vector<std::vector<SymbolLength>> shared(blocks), arena(blocks);
+	auto start1 = std::chrono::high_resolution_clock::now();
+	for (size_t i = 0; i < blocks; ++i)
+		shared[i] = CodeLengthsSharedTree(frequencies[i]);
+	auto end1 = std::chrono::high_resolution_clock::now();
+	auto us1 = std::chrono::duration_cast<std::chrono::microseconds>(end1 - start1).count();
+	std::cout << "Tree build shared_ptr takes " << us1 << " us for " << blocks << " blocks" << std::endl;
+
+	HuffmanArena scratch;
+	auto start2 = std::chrono::high_resolution_clock::now();
+	for (size_t i = 0; i < blocks; ++i)
+		MakeCodeLengths(frequencies[i], scratch, arena[i]);
+	auto end2 = std::chrono::high_resolution_clock::now();
+	auto us2 = std::chrono::duration_cast<std::chrono::microseconds>(end2 - start2).count();
+	std::cout << "Tree build arena      takes " << us2 << " us for " << blocks << " blocks" << std::endl;
+	std::cout << "Tree build speedup: " << (double)us1 / us2 << std::endl;
+
+	bool same = true;
+	for (size_t i = 0; i < blocks; ++i)
+		same = same && cost(frequencies[i], shared[i]) == cost(frequencies[i], arena[i]);
+	if (same)
+		std::cout << "Arena code lengths are ok" << std::endl;
+	else
+		std::cout << "Arena code lengths are wrong" << std::endl;
+}
+
+// Round trip of the same byte data coded as Symbol; returns whether it
+// decoded back and prints the decode time
+template<typename Symbol>
+bool TestSymbolType(const char* name, const std::vector<int>& values, int64_t offset)
+{
+	std::vector<Symbol> sequence(values.size());
+	for (size_t i = 0; i < values.size(); ++i)
+		sequence[i] = static_cast<Symbol>(values[i] + offset);
+	auto dictionary = MakeHuffmanDictionary(sequence.cbegin(), sequence.cend());
+	auto blocks = HuffmanCompressBlocks(sequence.cbegin(), sequence.cend(), dictionary, DEFAULT_BLOCK_SIZE,
+										ThreadPool::Serial());
+
+	auto start = std::chrono::high_resolution_clock::now();
+	auto decoded = HuffmanDecompress(BlockStreamView(blocks), dictionary);
+	auto end = std::chrono::high_resolution_clock::now();
+	auto us = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+	std::cout << "Symbol type " << name << ": decode " << us << " us, "
+			  << WordCount(blocks.data.bits) * sizeof(uint64_t) << " bytes" << std::endl;
+	return decoded == sequence;
+}
+
+void TestSymbolTypes(size_t size)
+{
+	auto values = GenerateGeometric(0.05, size);
+	for (auto& value : values)
+		value = std::min(value, 255);
+	bool same = TestSymbolType<uint8_t>("uint8 ", values, 0)
+				&& TestSymbolType<int8_t>("int8  ", values, -128)
+				&& TestSymbolType<uint16_t>("uint16", values, 1000)
+				&& TestSymbolType<int16_t>("int16 ", values, -1000)
+				&& TestSymbolType<int>("int32 ", values, 0)
+				&& TestSymbolType<int64_t>("int64 ", values, int64_t{1} << 40);
+	if (same)
+		std::cout << "Symbol type round trips are ok" << std::endl;
+	else
+		std::cout << "Symbol type round trips are wrong" << std::endl;
+}
+
+void TestLengthLimit(double p, size_t size)
+{
+	auto sequence = GenerateGeometric(p, size);
+	for (uint32_t max_length : {0u, 15u, 11u})
+	{
+		CompressOptions options;
+		options.max_code_length = max_length;
+		CompressedData compressed;
+		compressed.Compress(sequence.cbegin(), sequence.cend(), options);
+
+		auto start = std::chrono::high_resolution_clock::now();
+		auto decompressed = compressed.Decompress();
+		auto end = std::chrono::high_resolution_clock::now();
+		auto us = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+
+		std::cout << "Max code length " << max_length << ": longest " << compressed.Dictionary().MaxLength()
+				  << ", ratio cost " << compressed.Cost().Overhead() * 100 << " %, decode "
+				  << us << " us" << (decompressed == sequence ? ", ok" : ", wrong") << std::endl;
+	}
+}
+
+void TestAns(double noise, size_t size)
+{
+	// mostly one value, which Huffman cannot code below one bit per symbol
+	std::vector<int> sequence(size, 7);
+	std::mt19937 gen(0);
+	std::bernoulli_distribution is_noise(noise);
+	std::uniform_int_distribution<> distrib(0, 255);
+	for (auto& value : sequence)
+		value = is_noise(gen) ? distrib(gen) : value;
+
+	for (auto coder : {EntropyCoder::Huffman, EntropyCoder::Auto})
+	{
+		CompressOptions options;
+		options.coder = coder;
+		CompressedData compressed;
+		compressed.Compress(sequence.cbegin(), sequence.cend(), options);
+		size_t ans_blocks = std::count_if(compressed.Data().blocks.begin(), compressed.Data().blocks.end(),
+										  [](const auto& block) { return block.coder == BlockCoder::Ans; });
+
+		std::stringstream image;
+		compressed.Write(image);
+		std::string bytes = image.str();
+		auto aligned = std::make_shared<std::vector<uint64_t>>((bytes.size() + 7) / 8);
+		std::memcpy(aligned->data(), bytes.data(), bytes.size());
+		CompressedData loaded;
+		loaded.Load(aligned, reinterpret_cast<const unsigned char*>(aligned->data()), bytes.size());
+
+		auto start = std::chrono::high_resolution_clock::now();
+		auto decompressed = loaded.Decompress();
+		auto end = std::chrono::high_resolution_clock::now();
+		auto us = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+
+		// the plain Huffman decoder must refuse the rANS blocks
+		bool refused = false;
+		try
+		{
+			HuffmanDecompress(compressed.Data(), compressed.Dictionary());
+		}
+		catch (const std::invalid_argument&)
+		{
+			refused = true;
+		}
+		bool ok = decompressed == sequence && refused == (ans_blocks != 0);
+
+		std::cout << (coder == EntropyCoder::Huffman ? "Huffman blocks" : "Auto blocks   ") << ": "
+				  << compressed.SizeOfData() << " bytes, " << ans_blocks << " rANS blocks, decode "
+				  << us << " us" << (ok ? ", ok" : ", wrong") << std::endl;
+	}
+}
+
+void TestSubStreams(int min, int max, size_t size)
+{
+	auto sequence = Generate(min, max, size);
+	for (unsigned streams : {1u, 2u, 4u, 8u})
+	{
+		CompressOptions options;
+		options.streams = streams;
+		CompressedData compressed(ThreadPool::Serial());
+		compressed.Compress(sequence.cbegin(), sequence.cend(), options);
+
+		auto start = std::chrono::high_resolution_clock::now();
+		auto decompressed = compressed.Decompress();
+		auto end = std::chrono::high_resolution_clock::now();
+		auto us = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+		std::cout << "Huffman sub-streams " << streams << ": decode " << us << " us, "
+				  << compressed.SizeOfData() << " bytes" << (decompressed == sequence ? ", ok" : ", wrong")
+				  << std::endl;
+	}
+}
+
+void TestTransforms(size_t size)
+{
+	std::mt19937 gen(0);
+	std::vector<int> ids(size);                 // sorted IDs with small gaps
+	std::vector<int> sensor(size);              // slowly changing readings
+	std::vector<int> counter(size);             // long runs of one value
+	std::uniform_int_distribution<> gap(1, 8);
+	std::uniform_int_distribution<> step(-2, 2);
+	int id = 1'000'000, reading = 5'000;
+	for (size_t i = 0; i < size; ++i)
+	{
+		ids[i] = id += gap(gen);
+		sensor[i] = reading += step(gen);
+		counter[i] = static_cast<int>(i / 1000);
+	}
+
+	struct Case
+	{
+		const char* name;
+		const std::vector<int>& values;
+		std::vector<Transform> transforms;
+	};
+	const Case cases[] = {
+		{"sorted IDs", ids, {Transform::Delta}},
+		{"sensor    ", sensor, {Transform::Delta, Transform::ZigZag}},
+		{"sensor    ", sensor, {Transform::FrameOfReference}},
+		{"counter   ", counter, {Transform::Delta, Transform::RunLength}},
+	};
+	for (const auto& test : cases)
+	{
+		CompressedData raw;
+		raw.Compress(test.values.cbegin(), test.values.cend());
+		CompressOptions options;
+		options.transforms = test.transforms;
+		CompressedData transformed;
+		transformed.CompressParallel(test.values.cbegin(), test.values.cend(), options);
+		std::cout << "Transforms on " << test.name << ": " << raw.SizeOfData() << " -> "
+				  << transformed.SizeOfData() << " bytes, alphabet " << raw.Dictionary().symbols.size()
+				  << " -> " << transformed.Dictionary().symbols.size()
+				  << (transformed.Decompress() == test.values ? ", ok" : ", wrong") << std::endl;
+	}
+}
+
+void TestStats(int min, int max, size_t size)
+{
+	auto sequence = Generate(min, max, size);
+	CompressStats stats;
+	CompressOptions options;
+	options.coder = EntropyCoder::Auto;
+	options.transforms = {Transform::Delta, Transform::ZigZag};
+	CompressedData compressed;
+	compressed.SetStats(&stats);
+	compressed.CompressParallel(sequence.cbegin(), sequence.cend(), options);
+	bool same = compressed.Decompress() == sequence;
+	stats.Print(std::cout);
+
+	std::stringstream image;
+	compressed.Write(image);
+	if (same && compressed.SizeOfData() == image.str().size())
+		std::cout << "Stats and size of data are ok" << std::endl;
+	else
+		std::cout << "Stats and size of data are wrong" << std::endl;
+}
+
+void TestAdaptiveBlocks(size_t size)
+{
+	// the distribution drifts every quarter: narrow, shifted, wide noise,
+	// geometric
+	std::mt19937 gen(0);
+	std::vector<int> sequence(size);
+	for (size_t i = 0; i < size; ++i)
+	{
+		switch (4 * i / size)
+		{
+		case 0: sequence[i] = std::uniform_int_distribution<>(0, 15)(gen); break;
+		case 1: sequence[i] = std::uniform_int_distribution<>(5000, 5100)(gen); break;
+		case 2: sequence[i] = static_cast<int>(gen()); break;
+		default: sequence[i] = std::geometric_distribution<>(0.2)(gen); break;
+		}
+	}
+
+	CompressedData global;
+	global.CompressParallel(sequence.cbegin(), sequence.cend());
+	CompressOptions options;
+	options.adaptive = true;
+	CompressedData adaptive;
+	adaptive.CompressParallel(sequence.cbegin(), sequence.cend(), options);
+
+	size_t coders[4] = {0, 0, 0, 0};
+	for (const auto& block : adaptive.Data().blocks)
+		coders[static_cast<size_t>(block.coder)]++;
+	std::cout << "Adaptive blocks: " << global.SizeOfData() << " -> " << adaptive.SizeOfData() << " bytes, "
+			  << coders[0] << " global, " << coders[2] << " local, " << coders[3] << " stored" << std::endl;
+
+	std::stringstream image;
+	adaptive.Write(image);
+	std::string bytes = image.str();
+	auto aligned = std::make_shared<std::vector<uint64_t>>((bytes.size() + 7) / 8);
+	std::memcpy(aligned->data(), bytes.data(), bytes.size());
+	CompressedData loaded;
+	loaded.Load(aligned, reinterpret_cast<const unsigned char*>(aligned->data()), bytes.size());
+	if (adaptive.Decompress() == sequence && loaded.Decompress() == sequence)
+		std::cout << "Adaptive blocks are ok" << std::endl;
+	else
+		std::cout << "Adaptive blocks are wrong" << std::endl;
+}
+
+void TestDecompressRange(int min, int max, size_t size)
+{
+	auto sequence = Generate(min, max, size);
+	CompressOptions options;
+	options.block_size = 4096;
+	CompressedData compressed;
+	compressed.CompressParallel(sequence.cbegin(), sequence.cend(), options);
+	CompressOptions transformed_options = options;
+	transformed_options.transforms = {Transform::Delta, Transform::ZigZag};
+	CompressedData transformed;
+	transformed.CompressParallel(sequence.cbegin(), sequence.cend(), transformed_options);
+
+	std::vector<int> into(compressed.Size());
+	compressed.Decompress(into);
+	std::vector<int> appended;
+	transformed.Decompress(std::back_inserter(appended));
+	bool same = into == sequence && appended == sequence;
+
+	constexpr size_t slice = 1000;
+	size_t first = size / 2 + 123;
+	auto start1 = std::chrono::high_resolution_clock::now();
+	auto whole = compressed.Decompress();
+	auto end1 = std::chrono::high_resolution_clock::now();
+	auto range = compressed.DecompressRange(first, slice);
+	auto end2 = std::chrono::high_resolution_clock::now();
+	auto us1 = std::chrono::duration_cast<std::chrono::microseconds>(end1 - start1).count();
+	auto us2 = std::chrono::duration_cast<std::chrono::microseconds>(end2 - end1).count();
+	std::cout << "Decompress " << slice << " values: whole " << us1 << " us, range " << us2 << " us" << std::endl;
+
+	auto expected = sequence.cbegin() + first;
+	same = same && std::equal(range.cbegin(), range.cend(), expected)
+		   && transformed.DecompressRange(first, slice) == range
+		   && compressed.DecompressRange(size, 0).empty();
+	if (same)
+		std::cout << "Decompressed ranges are ok" << std::endl;
+	else
+		std::cout << "Decompressed ranges are wrong" << std::endl;
+}
+
+void TestSharedDictionary(int min, int max, size_t messages, size_t message_size)
+{
+	auto samples = Generate(min, max, 100'000, 1);
+	std::stringstream stored;
+	SharedDictionary::Train(samples.cbegin(), samples.cend(), 15).Write(stored);
+	auto dictionary = SharedDictionary::Read(stored);
+
+	// every message carries a few values the samples never had
+	auto sequence = Generate(min, max, messages * message_size, 2);
+	for (size_t i = 0; i < sequence.size(); i += message_size / 4)
+		sequence[i] = max + 1 + static_cast<int>(i % 7);
+
+	auto start1 = std::chrono::high_resolution_clock::now();
+	bool same1 = true;
+	for (size_t i = 0; i < messages; ++i)
+	{
+		auto first = sequence.cbegin() + i * message_size;
+		CompressedData compressed;
+		compressed.Compress(first, first + message_size);
+		same1 = same1 && std::equal(first, first + message_size, compressed.Decompress().cbegin());
+	}
+	auto end1 = std::chrono::high_resolution_clock::now();
+	auto us1 = std::chrono::duration_cast<std::chrono::microseconds>(end1 - start1).count();
+	std::cout << "Per-message dictionary takes " << (double)us1 / messages << " us per message" << std::endl;
+
+	auto start2 = std::chrono::high_resolution_clock::now();
+	bool same2 = true;
+	size_t payload = 0;
+	for (size_t i = 0; i < messages; ++i)
+	{
+		auto first = sequence.cbegin() + i * message_size;
+		auto message = dictionary.Compress(first, first + message_size);
+		payload += WordCount(message.data.bits) * sizeof(uint64_t);
+		same2 = same2 && std::equal(first, first + message_size, dictionary.Decompress(message).cbegin());
+	}
+	auto end2 = std::chrono::high_resolution_clock::now();
+	auto us2 = std::chrono::duration_cast<std::chrono::microseconds>(end2 - start2).count();
+	std::cout << "Shared dictionary      takes " << (double)us2 / messages << " us per message, "
+			  << (double)payload / messages << " bytes per message" << std::endl;
+
+	if (same1 && same2)
+		std::cout << "Shared dictionary messages are ok" << std::endl;
+	else
+		std::cout << "Shared dictionary messages are wrong" << std::endl;
+}
+
+// A signed "HUFD" image with three codes of length 1
+void TestMalformedDictionary()
+{
+	struct
+	{
+		char magic[4] = {'H', 'U', 'F', 'D'};
+		uint32_t version = 1;
+		int32_t escape = 3;
+		uint32_t max_code_length = 2;
+		uint32_t alphabet_size = 3;
+		uint32_t reserved = 0;
+		uint32_t length_count[2] = {3, 0};
+		int32_t symbols[3] = {1, 2, 3};
+	} image;
+	uint64_t checksum = FileFormat::Checksum64(&image, sizeof(image));
+	std::stringstream stored;
+	stored.write(reinterpret_cast<const char*>(&image), sizeof(image));
+	stored.write(reinterpret_cast<const char*>(&checksum), sizeof(checksum));
+	// a header claiming the largest alphabet, and nothing after it; refused
+	// as truncated rather than allocated up front
+	auto header = reinterpret_cast<const char*>(&image);
+	std::stringstream truncated;
+	truncated.write(header, 12);
+	uint32_t huge[3] = {32, 0xFFFFFFFF, 0};
+	truncated.write(reinterpret_cast<const char*>(huge), sizeof(huge));
+	bool rejected = true;
+	for (auto* stream : {&stored, &truncated})
+	{
+		try
+		{
+			SharedDictionary::Read(*stream);
+			rejected = false;
+		}
+		catch (const std::runtime_error&)
+		{
+		}
+	}
+	if (rejected)
+		std::cout << "Malformed shared dictionary is rejected" << std::endl;
+	else
+		std::cout << "Malformed shared dictionary is accepted" << std::endl;
+}
+
+void TestFile(int min, int max, size_t size)
+{
+	auto sequence = Generate(min, max, size);
+	CompressedData compressed;
+	compressed.CompressParallel(sequence.cbegin(), sequence.cend());
+	const std::string filename = "test_compressed.huf";
+	compressed.WriteToFile(filename);
+
+	CompressedData loaded;
+	loaded.ReadFromFile(filename);
+	if (loaded.Decompress() == sequence)
+		std::cout << "File round trip is ok" << std::endl;
+	else
+		std::cout << "File round trip is wrong" << std::endl;
+	std::remove(filename.c_str());
+}
+
+// Rewrites the file through patch and re-signs its metadata, then expects
+// ReadFromFile to reject it
+bool RejectsPatchedFile(const std::string& filename, const std::vector<char>& image,
+						const std::function<void(FileFormat::FileHeader&, std::vector<char>&)>& patch)
+{
+	auto bytes = image;
+	FileFormat::FileHeader header;
+	std::memcpy(&header, bytes.data(), sizeof(header));
+	patch(header, bytes);
+	header.metadata_checksum = 0;
+	std::memcpy(bytes.data(), &header, sizeof(header));
+	size_t metadata_size = std::min<size_t>(header.payload_offset, bytes.size());
+	header.metadata_checksum = FileFormat::Checksum64(bytes.data(), metadata_size);
+	std::memcpy(bytes.data(), &header, sizeof(header));
+	std::ofstream(filename, std::ios::binary).write(bytes.data(), bytes.size());
+	CompressedData loaded;
+	try
+	{
+		loaded.ReadFromFile(filename);
+	}
+	catch (const std::runtime_error&)
+	{
+		return true;
+	}
+	return false;
+}
+
+// Files whose metadata checksum matches but whose fields are hostile
+void TestMalformedFile()
+{
+	// three symbols: one code of length 1, two of length 2
+	std::vector<int> sequence{1, 1, 1, 1, 2, 2, 3};
+	CompressedData compressed;
+	compressed.Compress(sequence.cbegin(), sequence.cend());
+	const std::string filename = "test_malformed.huf";
+	compressed.WriteToFile(filename);
+	std::ifstream input(filename, std::ios::binary);
+	std::vector<char> image{std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>()};
+	input.close();
+
+	bool oversubscribed = RejectsPatchedFile(filename, image, [](auto&, auto& bytes)
+	{
+		uint32_t length_count[2] = {3, 0};
+		std::memcpy(bytes.data() + sizeof(FileFormat::FileHeader), length_count, sizeof(length_count));
+	});
+	bool wrapped = RejectsPatchedFile(filename, image, [](auto& header, auto&)
+	{
+		header.payload_words += uint64_t{1} << 61;
+	});
+	bool offset = RejectsPatchedFile(filename, image, [](auto& header, auto&)
+	{
+		header.payload_offset = header.file_size + 8;
+	});
+
+	// a block per value, so that the block table can be rewritten
+	std::vector<int> values(300, 1);
+	values.back() = 2;
+	CompressOptions options;
+	options.block_size = 1;
+	compressed.Compress(values.cbegin(), values.cend(), options);
+	compressed.WriteToFile(filename);
+	input.open(filename, std::ios::binary);
+	image.assign(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+	input.close();
+	auto patch_blocks = [&](const std::function<void(uint64_t*, size_t)>& patch)
+	{
+		return RejectsPatchedFile(filename, image, [&](auto& header, auto& bytes)
+		{
+			auto table = reinterpret_cast<uint64_t*>(bytes.data() + header.payload_offset
+													 - header.block_count * 2 * sizeof(uint64_t));
+			patch(table, header.block_count);
+		});
+	};
+	// counts summing to the symbol count only modulo 2^64
+	bool overflowing = patch_blocks([](uint64_t* table, size_t block_count)
+	{
+		for (size_t i = 0; i < block_count; ++i)
+		{
+			uint64_t count = i < 256 ? FileFormat::BLOCK_COUNT_MASK : i == 256 ? 256 + block_count : 0;
+			table[2 * i + 1] = (table[2 * i + 1] & ~FileFormat::BLOCK_COUNT_MASK) | count;
+		}
+	});
+	bool unsorted = patch_blocks([](uint64_t* table, size_t)
+	{
+		std::swap(table[0], table[2]);
+		if (table[0] == table[2])
+			table[0] = table[2] + 1;
+	});
+	if (oversubscribed && wrapped && offset && overflowing && unsorted)
+		std::cout << "Malformed files are rejected" << std::endl;
+	else
+		std::cout << "Malformed files are accepted" << std::endl;
+	std::remove(filename.c_str());
+}
+
+void TestStream(int min, int max, size_t size, size_t chunk_size)
+{
+	auto sequence = Generate(min, max, size);
+	std::stringstream stream;
+	{
+		StreamCompressor compressor(stream, chunk_size);
+		// uneven pushes so that chunks span several writes
+		for (size_t i = 0; i < sequence.size(); i += 1000)
+			compressor.Write(sequence.data() + i, std::min<size_t>(1000, sequence.size() - i));
+		compressor.Finish();
+	}
+
+	StreamDecompressor decompressor(stream);
+	std::vector<int> decompressed, chunk;
+	while (decompressor.Read(chunk))
+		decompressed.insert(decompressed.end(), chunk.cbegin(), chunk.cend());
+	if (decompressed == sequence)
+		std::cout << "Stream round trip is ok" << std::endl;
+	else
+		std::cout << "Stream round trip is wrong" << std::endl;
+}
+
+// A frame header claiming more than the chunk size or the stream holds is
+// refused before anything is allocated for it
+void TestMalformedStream()
+{
+	auto sequence = Generate(1, 100, 10'000);
+	std::stringstream stream;
+	{
+		StreamCompressor compressor(stream, 10'000);
+		compressor.Write(sequence.data(), sequence.size());
+	}
+	auto image = stream.str();
+	auto rejects = [&image](size_t chunk_size, uint64_t file_size)
+	{
+		auto bytes = image;
+		FileFormat::FileHeader header;
+		std::memcpy(&header, bytes.data(), sizeof(header));
+		if (file_size != 0)
+			header.file_size = file_size;
+		std::memcpy(bytes.data(), &header, sizeof(header));
+		std::stringstream patched(bytes);
+		StreamDecompressor decompressor(patched, chunk_size);
+		std::vector<int> chunk;
+		try
+		{
+			decompressor.Read(chunk);
+		}
+		catch (const std::runtime_error&)
+		{
+			return true;
+		}
+		return false;
+	};
+	bool huge = rejects(10'000, uint64_t{1} << 60);
+	bool past_end = rejects(10'000, image.size() + 64);
+	bool over_chunk = rejects(1'000, 0);
+	bool accepted = !rejects(10'000, 0);
+	if (huge && past_end && over_chunk && accepted)
+		std::cout << "Oversized stream frames are rejected" << std::endl;
+	else
+		std::cout << "Oversized stream frames are accepted" << std::endl;
+}
+
+void TestPipeline(int min, int max, size_t size)
+{
+	auto sequence = Generate(min, max, size);
+	const std::string raw = "test_pipeline.bin", compressed = "test_pipeline.huf", restored = "test_pipeline.out";
+	std::ofstream(raw, std::ios::binary).write(reinterpret_cast<const char*>(sequence.data()),
+												sequence.size() * sizeof(int));
+
+	bool ok = true;
+	for (bool use_mmap : {true, false})
+	{
+		PipelineOptions options;
+		options.chunk_size = size / 7;
+		options.use_mmap = use_mmap;
+		auto report = CompressFile(raw, compressed, options);
+		// the output is an ordinary frame stream, either side can read the other
+		std::ifstream stream(compressed, std::ios::binary);
+		StreamDecompressor decompressor(stream);
+		std::vector<int> decompressed, chunk;
+		while (decompressor.Read(chunk))
+			decompressed.insert(decompressed.end(), chunk.cbegin(), chunk.cend());
+
+		options.use_mmap = !use_mmap;
+		DecompressFile(compressed, restored, options);
+		std::vector<int> values(sequence.size() + 1);
+		std::ifstream output(restored, std::ios::binary);
+		output.read(reinterpret_cast<char*>(values.data()), values.size() * sizeof(int));
+		values.resize(output.gcount() / sizeof(int));
+		ok = ok && report.frames == 8 && decompressed == sequence && values == sequence;
+	}
+	if (ok)
+		std::cout << "File pipeline round trip is ok" << std::endl;
+	else
+		std::cout << "File pipeline round trip is wrong" << std::endl;
+	for (const auto& filename : {raw, compressed, restored})
+		std::remove(filename.c_str());
+}
+
 int main()
 {
 	constexpr size_t size = 1'000'000;
@@ -84,7 +938,28 @@ int main()
 	constexpr int max = 100;
 
 	Test1(min, max, size);
+	TestListInput(min, max, 100'000);
 	TestTime(min, max, size);
+	TestDecodeTime(min, max, size);
+	TestEncodeTime(min, max, size);
+	TestFrequencyTime(min, max, size);
+	TestFrequencyTime(min, max * 100'000, size);
+	TestTreeTime(min, max, 10'000, 1'000);
+	TestSymbolTypes(size);
+	TestLengthLimit(0.05, size);
+	TestAns(0.01, size);
+	TestSubStreams(min, max, size);
+	TestTransforms(size);
+	TestStats(min, max, size);
+	TestDecompressRange(min, max, size);
+	TestAdaptiveBlocks(size);
+	TestSharedDictionary(min, max, 10'000, 64);
+	TestMalformedDictionary();
+	TestFile(min, max, size);
+	TestMalformedFile();
+	TestStream(min, max, size, 1 << 16);
+	TestMalformedStream();
+	TestPipeline(min, max, size);
 
 	return 0;
 }
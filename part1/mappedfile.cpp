@@ -0,0 +1,69 @@
+// Source code for Test task
+// Licensed after GNU GPL v3
+
+#include "mappedfile.h"
+#include <stdexcept>
+#include <fstream>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define HAVE_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile(const std::string& filename)
+{
+#ifdef HAVE_MMAP
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd < 0)
+		throw std::runtime_error("Failed to open " + filename);
+	struct stat info;
+	if (::fstat(fd, &info) != 0)
+	{
+		::close(fd);
+		throw std::runtime_error("Failed to stat " + filename);
+	}
+	length = static_cast<size_t>(info.st_size);
+	if (length > 0)
+	{
+		void* mapped = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd);
+		if (mapped == MAP_FAILED)
+			throw std::runtime_error("Failed to map " + filename);
+		::madvise(mapped, length, MADV_SEQUENTIAL);
+		address = static_cast<const unsigned char*>(mapped);
+	}
+	else
+	{
+		::close(fd);
+	}
+#else
+	std::ifstream input_file(filename, std::ios::binary | std::ios::ate);
+	if (!input_file.is_open())
+		throw std::runtime_error("Failed to open " + filename);
+	length = input_file.tellg();
+	input_file.seekg(0);
+	fallback.resize((length + sizeof(fallback[0]) - 1) / sizeof(fallback[0]));
+	input_file.read(reinterpret_cast<char*>(fallback.data()), length);
+	address = reinterpret_cast<const unsigned char*>(fallback.data());
+#endif
+}
+
+bool MappedFile::Maps()
+{
+#ifdef HAVE_MMAP
+	return true;
+#else
+	return false;
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+#ifdef HAVE_MMAP
+	if (address != nullptr)
+		::munmap(const_cast<unsigned char*>(address), length);
+#endif
+}
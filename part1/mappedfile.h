@@ -0,0 +1,33 @@
+// Source code for Test task
+// Licensed after GNU GPL v3
+
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Read-only view of a whole file. Uses mmap where available and falls back
+// to reading the file into an 8-byte aligned buffer elsewhere.
+class MappedFile
+{
+	const unsigned char* address{nullptr};
+	size_t length{0};
+	std::vector<unsigned long long> fallback;
+
+public:
+	explicit MappedFile(const std::string& filename);
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	const unsigned char* data() const { return address; }
+	size_t size() const { return length; }
+
+	// Whether files are mapped on this platform rather than read whole
+	static bool Maps();
+};
+
+#endif // MAPPEDFILE_H
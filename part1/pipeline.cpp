@@ -0,0 +1,456 @@
+// Source code for Test task
+// Licensed after GNU GPL v3
+
+#include "pipeline.h"
+#include "fileformat.h"
+#include "mappedfile.h"
+#include "streamcompressor.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+
+namespace
+{
+constexpr size_t QUEUE_DEPTH = 2;
+// the coder holds its chunk, the transformed copy and the encoded frame
+constexpr size_t CODER_CHUNKS = 3;
+constexpr size_t MIN_CHUNK_SIZE = size_t{1} << 16;
+constexpr size_t PAGE_SIZE = 4096;
+constexpr double PROGRESS_INTERVAL = 0.5;
+
+using Clock = std::chrono::steady_clock;
+
+double Seconds(Clock::time_point since)
+{
+	return std::chrono::duration<double>(Clock::now() - since).count();
+}
+
+// Hands items from one stage to the next. After Close, Push drops its item
+// and Pop drains what is left before it returns nothing.
+template<typename T>
+class StageQueue
+{
+	std::deque<T> items;
+	size_t capacity;
+	bool closed{false};
+	std::mutex mutex;
+	std::condition_variable changed;
+
+public:
+	explicit StageQueue(size_t capacity)
+		: capacity{capacity}
+	{}
+
+	bool Push(T item)
+	{
+		std::unique_lock lock(mutex);
+		changed.wait(lock, [this] { return closed || items.size() < capacity; });
+		if (closed)
+			return false;
+		items.push_back(std::move(item));
+		changed.notify_all();
+		return true;
+	}
+
+	std::optional<T> Pop()
+	{
+		std::unique_lock lock(mutex);
+		changed.wait(lock, [this] { return closed || !items.empty(); });
+		if (items.empty())
+			return std::nullopt;
+		T item = std::move(items.front());
+		items.pop_front();
+		changed.notify_all();
+		return item;
+	}
+
+	void Close()
+	{
+		std::lock_guard lock(mutex);
+		closed = true;
+		changed.notify_all();
+	}
+};
+
+// First error of any stage
+class StageFailure
+{
+	std::exception_ptr error;
+	std::mutex mutex;
+
+public:
+	void Set(std::exception_ptr failure)
+	{
+		std::lock_guard lock(mutex);
+		if (error == nullptr)
+			error = failure;
+	}
+
+	bool Failed()
+	{
+		std::lock_guard lock(mutex);
+		return error != nullptr;
+	}
+
+	void Rethrow()
+	{
+		if (error != nullptr)
+			std::rethrow_exception(error);
+	}
+};
+
+// Touches every page of a mapped chunk, so that the reader takes the page
+// faults instead of the coder
+void Prefault(const void* data, size_t size)
+{
+	const volatile unsigned char* bytes = static_cast<const volatile unsigned char*>(data);
+	for (size_t offset = 0; offset < size; offset += PAGE_SIZE)
+		(void)bytes[offset];
+}
+
+class Progress
+{
+	std::ostream* output;
+	const char* verb;
+	uint64_t total;
+	Clock::time_point start{Clock::now()};
+	Clock::time_point last{start};
+
+public:
+	Progress(std::ostream* output, const char* verb, uint64_t total)
+		: output{output}, verb{verb}, total{total}
+	{}
+
+	void Update(uint64_t done, bool final = false)
+	{
+		if (output == nullptr)
+			return;
+		auto now = Clock::now();
+		if (!final && std::chrono::duration<double>(now - last).count() < PROGRESS_INTERVAL)
+			return;
+		last = now;
+		double seconds = std::max(std::chrono::duration<double>(now - start).count(), 1e-9);
+		*output << '\r' << verb << ' ' << std::fixed << std::setprecision(1) << done / 1e6 << " / "
+				<< total / 1e6 << " MB (" << (total != 0 ? 100.0 * done / total : 100.0) << " %), "
+				<< done / 1e6 / seconds << " MB/s" << std::defaultfloat << std::flush;
+		if (final)
+			*output << std::endl;
+	}
+};
+
+std::ofstream OpenOutput(const std::string& filename)
+{
+	std::ofstream output(filename, std::ios::binary);
+	if (!output.is_open())
+		throw std::runtime_error("Failed to open " + filename);
+	return output;
+}
+
+struct InputChunk
+{
+	const int32_t* values{nullptr};
+	size_t count{0};
+	std::vector<int32_t> storage;   // owns the values when the input is not mapped
+};
+}
+
+void PipelineReport::Print(std::ostream& output) const
+{
+	output << input_bytes << " -> " << output_bytes << " bytes in " << frames << " frames"
+		   << (mapped ? ", mapped input" : "") << std::endl;
+	output << "Took " << seconds * 1e3 << " ms, " << input_bytes / 1e6 / std::max(seconds, 1e-9)
+		   << " MB/s; busy read " << read_seconds * 1e3 << " ms, code " << code_seconds * 1e3
+		   << " ms, write " << write_seconds * 1e3 << " ms" << std::endl;
+}
+
+size_t PipelineChunkSize(const PipelineOptions& options)
+{
+	if (options.chunk_size != 0)
+		return options.chunk_size;
+	size_t chunks_in_flight = 2 * QUEUE_DEPTH + CODER_CHUNKS;
+	return std::max(options.memory_budget / (chunks_in_flight * sizeof(int32_t)), MIN_CHUNK_SIZE);
+}
+
+PipelineReport CompressFile(const std::string& input, const std::string& output, const PipelineOptions& options)
+{
+	auto start = Clock::now();
+	PipelineReport report;
+	ThreadPool pool(options.threads != 0 ? options.threads : HardwareThreads());
+	size_t chunk_size = PipelineChunkSize(options);
+
+	std::unique_ptr<MappedFile> mapped;
+	std::ifstream stream;
+	if (options.use_mmap && MappedFile::Maps())
+	{
+		mapped = std::make_unique<MappedFile>(input);
+		report.input_bytes = mapped->size();
+		report.mapped = true;
+	}
+	else
+	{
+		stream.open(input, std::ios::binary | std::ios::ate);
+		if (!stream.is_open())
+			throw std::runtime_error("Failed to open " + input);
+		report.input_bytes = stream.tellg();
+		stream.seekg(0);
+	}
+	if (report.input_bytes % sizeof(int32_t) != 0)
+		throw std::runtime_error("Input is not a whole number of 32-bit values");
+	size_t total = report.input_bytes / sizeof(int32_t);
+	auto out = OpenOutput(output);
+
+	StageQueue<InputChunk> chunks(QUEUE_DEPTH);
+	StageQueue<CompressedData> frames(QUEUE_DEPTH);
+	StageFailure failure;
+	auto abort = [&](std::exception_ptr error)
+	{
+		failure.Set(error);
+		chunks.Close();
+		frames.Close();
+	};
+
+	std::thread reader([&]
+	{
+		try
+		{
+			for (size_t first = 0; first < total; first += chunk_size)
+			{
+				auto begin = Clock::now();
+				InputChunk chunk;
+				chunk.count = std::min(chunk_size, total - first);
+				if (mapped != nullptr)
+				{
+					chunk.values = reinterpret_cast<const int32_t*>(mapped->data()) + first;
+					Prefault(chunk.values, chunk.count * sizeof(int32_t));
+				}
+				else
+				{
+					chunk.storage.resize(chunk.count);
+					if (!stream.read(reinterpret_cast<char*>(chunk.storage.data()), chunk.count * sizeof(int32_t)))
+						throw std::runtime_error("Failed to read " + input);
+					chunk.values = chunk.storage.data();
+				}
+				report.read_seconds += Seconds(begin);
+				if (!chunks.Push(std::move(chunk)))
+					return;
+			}
+			chunks.Close();
+		}
+		catch (...)
+		{
+			abort(std::current_exception());
+		}
+	});
+
+	std::thread writer([&]
+	{
+		try
+		{
+			uint64_t symbols = 0;
+			while (auto frame = frames.Pop())
+			{
+				auto begin = Clock::now();
+				frame->Write(out);
+				if (!out)
+					throw std::runtime_error("Failed to write " + output);
+				report.output_bytes += frame->SizeOfData();
+				report.frames += 1;
+				symbols += frame->Size();
+				report.write_seconds += Seconds(begin);
+			}
+			if (failure.Failed())
+				return;
+			auto begin = Clock::now();
+			StreamFormat::WriteTrailer(out, report.frames, symbols);
+			out.flush();
+			if (!out)
+				throw std::runtime_error("Failed to write " + output);
+			report.output_bytes += StreamFormat::TRAILER_SIZE;
+			report.write_seconds += Seconds(begin);
+		}
+		catch (...)
+		{
+			abort(std::current_exception());
+		}
+	});
+
+	try
+	{
+		Progress progress(options.progress, "Compressed", report.input_bytes);
+		uint64_t done = 0;
+		while (auto chunk = chunks.Pop())
+		{
+			auto begin = Clock::now();
+			CompressedData frame(pool);
+			frame.CompressParallel(chunk->values, chunk->values + chunk->count, options.compress);
+			report.code_seconds += Seconds(begin);
+			done += chunk->count * sizeof(int32_t);
+			if (!frames.Push(std::move(frame)))
+				break;
+			progress.Update(done, done == report.input_bytes);
+		}
+		frames.Close();
+	}
+	catch (...)
+	{
+		abort(std::current_exception());
+	}
+	reader.join();
+	writer.join();
+	failure.Rethrow();
+	report.seconds = Seconds(start);
+	return report;
+}
+
+PipelineReport DecompressFile(const std::string& input, const std::string& output, const PipelineOptions& options)
+{
+	auto start = Clock::now();
+	PipelineReport report;
+	ThreadPool pool(options.threads != 0 ? options.threads : HardwareThreads());
+	// frames larger than the chunks of these options are refused, so a
+	// corrupt stream cannot claim more memory than compressing would
+	size_t chunk_size = PipelineChunkSize(options);
+
+	std::shared_ptr<MappedFile> mapped;
+	std::ifstream stream;
+	if (options.use_mmap && MappedFile::Maps())
+	{
+		mapped = std::make_shared<MappedFile>(input);
+		report.input_bytes = mapped->size();
+		report.mapped = true;
+	}
+	else
+	{
+		stream.open(input, std::ios::binary | std::ios::ate);
+		if (!stream.is_open())
+			throw std::runtime_error("Failed to open " + input);
+		report.input_bytes = stream.tellg();
+		stream.seekg(0);
+	}
+	auto out = OpenOutput(output);
+
+	StageQueue<CompressedData> frames(QUEUE_DEPTH);
+	StageQueue<std::vector<int>> chunks(QUEUE_DEPTH);
+	StageFailure failure;
+	auto abort = [&](std::exception_ptr error)
+	{
+		failure.Set(error);
+		frames.Close();
+		chunks.Close();
+	};
+
+	// Mapped frames are loaded in place, which verifies their checksums and
+	// pages them in on the reader thread
+	std::thread reader([&]
+	{
+		try
+		{
+			StreamDecompressor decompressor(stream, chunk_size);
+			const unsigned char* data = mapped != nullptr ? mapped->data() : nullptr;
+			size_t size = report.input_bytes;
+			size_t offset = 0;
+			uint64_t nframes = 0;
+			uint64_t symbols = 0;
+			while (true)
+			{
+				auto begin = Clock::now();
+				CompressedData frame(pool);
+				if (mapped == nullptr)
+				{
+					if (!decompressor.ReadFrame(frame))
+						break;
+				}
+				else
+				{
+					if (size - offset >= StreamFormat::TRAILER_SIZE
+						&& std::memcmp(data + offset, StreamFormat::TRAILER_MAGIC,
+									   sizeof(StreamFormat::TRAILER_MAGIC)) == 0)
+					{
+						StreamFormat::CheckTrailer(reinterpret_cast<const char*>(data + offset), nframes, symbols);
+						break;
+					}
+					FileFormat::FileHeader header;
+					if (size - offset < sizeof(header))
+						throw std::runtime_error("Compressed stream is truncated");
+					std::memcpy(&header, data + offset, sizeof(header));
+					if (header.file_size < sizeof(header) || header.file_size > size - offset)
+						throw std::runtime_error("Compressed stream frame is malformed");
+					if (header.symbol_count > chunk_size)
+						throw std::runtime_error("Compressed stream frame exceeds the chunk size");
+					frame.Load(mapped, data + offset, header.file_size);
+					offset += header.file_size;
+					nframes += 1;
+					symbols += frame.Size();
+				}
+				report.read_seconds += Seconds(begin);
+				if (!frames.Push(std::move(frame)))
+					return;
+			}
+			frames.Close();
+		}
+		catch (...)
+		{
+			abort(std::current_exception());
+		}
+	});
+
+	std::thread writer([&]
+	{
+		try
+		{
+			while (auto chunk = chunks.Pop())
+			{
+				auto begin = Clock::now();
+				out.write(reinterpret_cast<const char*>(chunk->data()), chunk->size() * sizeof(int32_t));
+				if (!out)
+					throw std::runtime_error("Failed to write " + output);
+				report.output_bytes += chunk->size() * sizeof(int32_t);
+				report.write_seconds += Seconds(begin);
+			}
+			out.flush();
+			if (!out)
+				throw std::runtime_error("Failed to write " + output);
+		}
+		catch (...)
+		{
+			abort(std::current_exception());
+		}
+	});
+
+	try
+	{
+		Progress progress(options.progress, "Decompressed", report.input_bytes);
+		uint64_t done = 0;
+		while (auto frame = frames.Pop())
+		{
+			auto begin = Clock::now();
+			auto values = frame->Decompress();
+			report.code_seconds += Seconds(begin);
+			report.frames += 1;
+			done += frame->SizeOfData();
+			if (!chunks.Push(std::move(values)))
+				break;
+			progress.Update(done);
+		}
+		chunks.Close();
+		if (!failure.Failed())
+			progress.Update(report.input_bytes, true);
+	}
+	catch (...)
+	{
+		abort(std::current_exception());
+	}
+	reader.join();
+	writer.join();
+	failure.Rethrow();
+	report.seconds = Seconds(start);
+	return report;
+}
@@ -0,0 +1,58 @@
+// Source code for Test task
+// Licensed after GNU GPL v3
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include "compressor.h"
+
+// File-to-file compression as three overlapping stages: a reader thread,
+// the coder on the calling thread and its pool, and a writer thread. Each
+// pair of stages is joined by a queue of two chunks, so the reader fills
+// one chunk while the coder works on the other and the writer drains the
+// previous frame. Input is raw host-order int32 values, output the frame
+// stream of StreamCompressor (see streamcompressor.h), so both sides
+// interoperate with it.
+struct PipelineOptions
+{
+	size_t threads{0};                          // coder pool size, 0 for HardwareThreads()
+	size_t memory_budget{size_t{256} << 20};    // bytes of chunks in flight when compressing
+	size_t chunk_size{0};                       // values per frame, 0 derives it from the budget
+	bool use_mmap{true};                        // map the input where the platform allows
+	CompressOptions compress;                   // applied to every frame
+	std::ostream* progress{nullptr};            // periodic progress lines when set
+};
+
+struct PipelineReport
+{
+	uint64_t input_bytes{0};
+	uint64_t output_bytes{0};
+	size_t frames{0};
+	bool mapped{false};         // input was memory-mapped
+	double seconds{0};
+	// busy time of every stage; overlapping stages add up to more than
+	// seconds
+	double read_seconds{0};
+	double code_seconds{0};
+	double write_seconds{0};
+
+	void Print(std::ostream& output) const;
+};
+
+// Values per frame for the options: the budget covers the queued chunks on
+// both sides of the coder and the coder's own working set
+size_t PipelineChunkSize(const PipelineOptions& options);
+
+// Both throw std::runtime_error when a file cannot be opened or the input
+// is malformed. DecompressFile also refuses frames of more values than
+// PipelineChunkSize of its options, which must therefore allow at least
+// the chunks the file was compressed with.
+PipelineReport CompressFile(const std::string& input, const std::string& output,
+							const PipelineOptions& options = {});
+PipelineReport DecompressFile(const std::string& input, const std::string& output,
+							  const PipelineOptions& options = {});
+
+#endif // PIPELINE_H
@@ -0,0 +1,179 @@
+// Source code for Test task
+// Licensed after GNU GPL v3
+
+#include "shareddictionary.h"
+#include "fileformat.h"
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <stdexcept>
+
+namespace HuffmanTree
+{
+
+namespace
+{
+constexpr char MAGIC[4] = {'H', 'U', 'F', 'D'};
+constexpr uint32_t VERSION = 1;
+// symbols read at a time
+constexpr size_t READ_CHUNK_SYMBOLS = size_t{1} << 16;
+
+struct DictionaryHeader
+{
+	char magic[4];
+	uint32_t version;
+	int32_t escape;
+	uint32_t max_code_length;
+	uint32_t alphabet_size;
+	uint32_t reserved;
+};
+
+int ChooseEscape(const HTFrequency& frequency)
+{
+	if (frequency.empty())
+		return 0;
+	std::vector<int> values;
+	values.reserve(frequency.size());
+	for (const auto& symbol : frequency)
+		values.push_back(symbol.value);
+	std::sort(values.begin(), values.end());
+	if (values.back() != INT_MAX)
+		return values.back() + 1;
+	if (values.front() != INT_MIN)
+		return values.front() - 1;
+	for (size_t i = 1; i < values.size(); ++i)
+	{
+		if (values[i] != values[i - 1] + 1)
+			return values[i - 1] + 1;
+	}
+	throw std::invalid_argument("No value left for the escape symbol");
+}
+}
+
+void SharedDictionary::Build(std::vector<SymbolLength> lengths)
+{
+	dictionary = HTDistionary(std::move(lengths));
+	decoder = HuffmanDecoder(dictionary, &escape);
+}
+
+SharedDictionary SharedDictionary::Train(HTFrequency frequency, uint32_t max_code_length)
+{
+	SharedDictionary result;
+	result.escape = ChooseEscape(frequency);
+	uint64_t seen_once = std::count_if(frequency.cbegin(), frequency.cend(), [](const auto& symbol)
+	{
+		return symbol.frequency == 1;
+	});
+	frequency.push_back({result.escape, std::max<uint64_t>(seen_once, 1)});
+	result.Build(MakeCodeLengths(frequency, max_code_length));
+	return result;
+}
+
+void SharedDictionary::Decompress(const CompressedMessage& message, int* out) const
+{
+	decoder.DecodeEscaped(message.data.words.data(), message.data.words.size(), 0,
+						  out, message.symbol_count, escape);
+}
+
+std::vector<int> SharedDictionary::Decompress(const CompressedMessage& message) const
+{
+	std::vector<int> result(message.symbol_count);
+	Decompress(message, result.data());
+	return result;
+}
+
+void SharedDictionary::Write(std::ostream& output) const
+{
+	DictionaryHeader header{};
+	std::copy(std::begin(MAGIC), std::end(MAGIC), header.magic);
+	header.version = VERSION;
+	header.escape = escape;
+	header.max_code_length = dictionary.MaxLength();
+	header.alphabet_size = static_cast<uint32_t>(dictionary.symbols.size());
+
+	std::vector<uint32_t> length_count(header.max_code_length, 0);
+	for (auto length : dictionary.lengths)
+		length_count[length - 1]++;
+	std::vector<int32_t> symbols(dictionary.symbols.cbegin(), dictionary.symbols.cend());
+
+	std::vector<unsigned char> buffer(sizeof(header) + length_count.size() * sizeof(uint32_t)
+									  + symbols.size() * sizeof(int32_t));
+	std::memcpy(buffer.data(), &header, sizeof(header));
+	if (!length_count.empty())
+		std::memcpy(buffer.data() + sizeof(header), length_count.data(), length_count.size() * sizeof(uint32_t));
+	if (!symbols.empty())
+		std::memcpy(buffer.data() + sizeof(header) + length_count.size() * sizeof(uint32_t),
+					symbols.data(), symbols.size() * sizeof(int32_t));
+	uint64_t checksum = FileFormat::Checksum64(buffer.data(), buffer.size());
+
+	output.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+	output.write(reinterpret_cast<const char*>(&checksum), sizeof(checksum));
+}
+
+SharedDictionary SharedDictionary::Read(std::istream& input)
+{
+	DictionaryHeader header;
+	if (!input.read(reinterpret_cast<char*>(&header), sizeof(header))
+		|| !std::equal(std::begin(MAGIC), std::end(MAGIC), header.magic))
+		throw std::runtime_error("Not a shared dictionary");
+	if (header.version != VERSION)
+		throw std::runtime_error("Unsupported shared dictionary version");
+	// codes of max_code_length bits tell apart at most 2^max_code_length
+	// symbols
+	if (header.max_code_length > WORD_BITS || header.alphabet_size == 0
+		|| header.alphabet_size > uint64_t{1} << std::min<uint32_t>(header.max_code_length, 32))
+		throw std::runtime_error("Shared dictionary is malformed");
+
+	std::vector<uint32_t> length_count(header.max_code_length);
+	input.read(reinterpret_cast<char*>(length_count.data()), length_count.size() * sizeof(uint32_t));
+	// the symbols grow with what the stream holds rather than with the
+	// unverified alphabet size, so a truncated file allocates little
+	std::vector<int32_t> symbols;
+	while (input && symbols.size() < header.alphabet_size)
+	{
+		size_t offset = symbols.size();
+		symbols.resize(offset + std::min<size_t>(header.alphabet_size - offset, READ_CHUNK_SYMBOLS));
+		input.read(reinterpret_cast<char*>(symbols.data() + offset), (symbols.size() - offset) * sizeof(int32_t));
+	}
+	uint64_t checksum;
+	input.read(reinterpret_cast<char*>(&checksum), sizeof(checksum));
+	if (!input)
+		throw std::runtime_error("Shared dictionary is truncated");
+
+	std::vector<unsigned char> buffer(sizeof(header) + length_count.size() * sizeof(uint32_t)
+									  + symbols.size() * sizeof(int32_t));
+	std::memcpy(buffer.data(), &header, sizeof(header));
+	std::memcpy(buffer.data() + sizeof(header), length_count.data(), length_count.size() * sizeof(uint32_t));
+	std::memcpy(buffer.data() + sizeof(header) + length_count.size() * sizeof(uint32_t),
+				symbols.data(), symbols.size() * sizeof(int32_t));
+	if (FileFormat::Checksum64(buffer.data(), buffer.size()) != checksum)
+		throw std::runtime_error("Shared dictionary checksum mismatch");
+	// the checksum is not keyed, so the lengths may still be hostile; the
+	// decoder tables only hold the codes of a prefix code
+	if (!IsPrefixCode(length_count))
+		throw std::runtime_error("Shared dictionary is not a prefix code");
+
+	std::vector<SymbolLength> lengths;
+	lengths.reserve(symbols.size());
+	size_t index = 0;
+	for (uint32_t length = 1; length <= header.max_code_length; ++length)
+	{
+		for (uint32_t k = 0; k < length_count[length - 1]; ++k)
+		{
+			if (index == symbols.size())
+				throw std::runtime_error("Shared dictionary is malformed");
+			lengths.push_back({symbols[index++], length});
+		}
+	}
+	if (index != symbols.size())
+		throw std::runtime_error("Shared dictionary is malformed");
+
+	SharedDictionary result;
+	result.escape = header.escape;
+	result.Build(std::move(lengths));
+	if (result.dictionary.Find(result.escape) == nullptr)
+		throw std::runtime_error("Shared dictionary has no escape code");
+	return result;
+}
+
+}
@@ -0,0 +1,95 @@
+// Source code for Test task
+// Licensed after GNU GPL v3
+
+#ifndef SHAREDDICTIONARY_H
+#define SHAREDDICTIONARY_H
+
+#include <istream>
+#include <ostream>
+#include <vector>
+#include "huffmantree.h"
+
+namespace HuffmanTree
+{
+
+// A message compressed against a SharedDictionary. It carries no dictionary
+// of its own, so small messages cost only their payload.
+struct CompressedMessage
+{
+	BitStream data;
+	size_t symbol_count{0};
+};
+
+// Dictionary trained once on sample data and shared by many small messages,
+// so no message pays for counting, tree build or decoder tables. Values
+// missing from the samples are coded as an escape code followed by the raw
+// 32-bit value. The escape takes a value absent from the samples and is
+// weighted by the share of values seen only once, a Good-Turing estimate of
+// how often new values show up.
+class SharedDictionary
+{
+	HTDistionary dictionary;
+	HuffmanDecoder decoder;
+	int escape{0};
+
+	static constexpr unsigned RAW_BITS = 32;
+
+	void Build(std::vector<SymbolLength> lengths);
+
+public:
+	SharedDictionary() = default;
+
+	static SharedDictionary Train(HTFrequency frequency, uint32_t max_code_length = 0);
+
+	template<typename It>
+	static SharedDictionary Train(It first, It last, uint32_t max_code_length = 0)
+	{
+		return Train(MakeHuffmanFrequency(first, last), max_code_length);
+	}
+
+	template<typename It>
+	CompressedMessage Compress(It first, It last) const
+	{
+		const auto& escape_code = dictionary.Code(escape);
+		CompressedMessage message;
+		message.symbol_count = std::distance(first, last);
+		for (It it = first; it != last; ++it)
+		{
+			auto code = dictionary.Find(*it);
+			message.data.bits += code != nullptr && *it != escape ? code->length
+																   : escape_code.length + RAW_BITS;
+		}
+		message.data.words.resize(WordCount(message.data.bits));
+		BitWriter writer(message.data.words.data());
+		for (It it = first; it != last; ++it)
+		{
+			auto code = dictionary.Find(*it);
+			if (code != nullptr && *it != escape)
+			{
+				writer.Write(code->bits, code->length);
+			}
+			else
+			{
+				writer.Write(escape_code.bits, escape_code.length);
+				writer.Write(static_cast<uint32_t>(*it), RAW_BITS);
+			}
+		}
+		writer.Flush();
+		return message;
+	}
+
+	std::vector<int> Decompress(const CompressedMessage& message) const;
+	void Decompress(const CompressedMessage& message, int* out) const;
+
+	const HTDistionary& Dictionary() const { return dictionary; }
+	int Escape() const { return escape; }
+
+	// "HUFD" magic, version, escape, code length counts and symbols, checksum
+	void Write(std::ostream& output) const;
+	// Throws std::runtime_error on a malformed dictionary
+	static SharedDictionary Read(std::istream& input);
+};
+
+}
+
+#endif // SHAREDDICTIONARY_H
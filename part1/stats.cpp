@@ -0,0 +1,50 @@
+// Source code for Test task
+// Licensed after GNU GPL v3
+
+#include "stats.h"
+#include <iomanip>
+
+namespace HuffmanTree
+{
+
+std::vector<double> CompressStats::ThreadSeconds(const std::vector<BlockTiming>& blocks)
+{
+	std::vector<double> result;
+	for (const auto& timing : blocks)
+	{
+		if (timing.thread >= result.size())
+			result.resize(timing.thread + 1, 0);
+		result[timing.thread] += timing.seconds;
+	}
+	return result;
+}
+
+void CompressStats::Print(std::ostream& output) const
+{
+	const std::pair<const char*, const StageStats*> stages[] = {
+		{"transform", &transform},
+		{"frequency", &frequency},
+		{"tree", &tree},
+		{"dictionary", &dictionary},
+		{"encode", &encode},
+		{"concatenation", &concatenation},
+		{"decode", &decode},
+	};
+	for (const auto& [name, stage] : stages)
+	{
+		output << std::left << std::setw(14) << name << std::right << std::setw(12)
+			   << stage->seconds * 1e6 << " us" << std::setw(14) << stage->input_bytes << " B in"
+			   << std::setw(14) << stage->output_bytes << " B out" << std::endl;
+	}
+	for (const auto& [name, blocks] : {std::make_pair("encode", &encode_blocks),
+									   std::make_pair("decode", &decode_blocks)})
+	{
+		auto threads = ThreadSeconds(*blocks);
+		output << name << " blocks per thread:";
+		for (size_t t = 0; t < threads.size(); ++t)
+			output << " [" << t << "] " << threads[t] * 1e6 << " us";
+		output << std::endl;
+	}
+}
+
+}
@@ -0,0 +1,86 @@
+// Source code for Test task
+// Licensed after GNU GPL v3
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+namespace HuffmanTree
+{
+
+struct StageStats
+{
+	double seconds{0};
+	uint64_t input_bytes{0};
+	uint64_t output_bytes{0};
+};
+
+struct BlockTiming
+{
+	size_t block{0};
+	size_t thread{0};       // ThreadPool::CurrentThread of the participant
+	double seconds{0};
+};
+
+// Opt-in instrumentation of CompressedData, see CompressedData::SetStats.
+// Stages add up over calls until Reset; without a stats object nothing is
+// timed.
+struct CompressStats
+{
+	StageStats transform;       // forward block transforms
+	StageStats frequency;
+	StageStats tree;            // code lengths
+	StageStats dictionary;      // canonical codes, lookup and rANS tables
+	StageStats encode;          // block sizing and encoding passes
+	StageStats concatenation;   // block offsets and the shared word buffer
+	StageStats decode;          // entropy decoding and undoing the transforms
+	std::vector<BlockTiming> encode_blocks;
+	std::vector<BlockTiming> decode_blocks;
+
+	void Reset()
+	{
+		*this = {};
+	}
+
+	// Busy seconds of every pool thread over the given block timings
+	static std::vector<double> ThreadSeconds(const std::vector<BlockTiming>& blocks);
+
+	void Print(std::ostream& output) const;
+};
+
+// Adds the lifetime of the timer to a stage, does nothing for nullptr
+class StageTimer
+{
+	StageStats* stage;
+	std::chrono::steady_clock::time_point start;
+
+public:
+	explicit StageTimer(StageStats* stage)
+		: stage{stage}
+	{
+		if (stage != nullptr)
+			start = std::chrono::steady_clock::now();
+	}
+
+	~StageTimer()
+	{
+		if (stage != nullptr)
+			stage->seconds += Elapsed(start);
+	}
+
+	StageTimer(const StageTimer&) = delete;
+	StageTimer& operator=(const StageTimer&) = delete;
+
+	static double Elapsed(std::chrono::steady_clock::time_point since)
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - since).count();
+	}
+};
+
+}
+
+#endif // STATS_H
@@ -0,0 +1,179 @@
+// Source code for Test task
+// Licensed after GNU GPL v3
+
+#include "streamcompressor.h"
+#include "fileformat.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+using namespace StreamFormat;
+
+namespace
+{
+// A Huffman code of at most 64 bits, 6 bytes of dictionary and rANS
+// frequency and 5 of local table per value; the block index and stream
+// headers fit the rest at any block size of a few dozen values or more
+constexpr size_t MAX_FRAME_BYTES_PER_VALUE = 32;
+// header, length counts and block padding of a frame
+constexpr size_t FRAME_OVERHEAD = size_t{1} << 12;
+
+// Bytes left in the input, SIZE_MAX when it cannot seek
+size_t RemainingBytes(std::istream& input)
+{
+	auto* buffer = input.rdbuf();
+	auto position = buffer->pubseekoff(0, std::ios::cur, std::ios::in);
+	if (position == std::streampos(-1))
+		return SIZE_MAX;
+	auto end = buffer->pubseekoff(0, std::ios::end, std::ios::in);
+	buffer->pubseekpos(position, std::ios::in);
+	if (end == std::streampos(-1) || end < position)
+		return SIZE_MAX;
+	return static_cast<size_t>(end - position);
+}
+}
+
+size_t MaxFrameBytes(size_t chunk_size)
+{
+	if (chunk_size > (SIZE_MAX - FRAME_OVERHEAD) / MAX_FRAME_BYTES_PER_VALUE)
+		return SIZE_MAX;
+	return FRAME_OVERHEAD + chunk_size * MAX_FRAME_BYTES_PER_VALUE;
+}
+
+void StreamFormat::WriteTrailer(std::ostream& output, uint64_t frames, uint64_t symbols)
+{
+	uint32_t version = VERSION;
+	uint64_t trailer[2] = {frames, symbols};
+	output.write(TRAILER_MAGIC, sizeof(TRAILER_MAGIC));
+	output.write(reinterpret_cast<const char*>(&version), sizeof(version));
+	output.write(reinterpret_cast<const char*>(trailer), sizeof(trailer));
+}
+
+void StreamFormat::CheckTrailer(const char* data, uint64_t frames, uint64_t symbols)
+{
+	uint32_t version;
+	uint64_t trailer[2];
+	std::memcpy(&version, data + sizeof(TRAILER_MAGIC), sizeof(version));
+	std::memcpy(trailer, data + sizeof(TRAILER_MAGIC) + sizeof(version), sizeof(trailer));
+	if (!std::equal(std::begin(TRAILER_MAGIC), std::end(TRAILER_MAGIC), data) || version != VERSION)
+		throw std::runtime_error("Compressed stream trailer is malformed");
+	if (trailer[0] != frames || trailer[1] != symbols)
+		throw std::runtime_error("Compressed stream is missing frames");
+}
+
+StreamCompressor::StreamCompressor(std::ostream& output, size_t chunk_size)
+	: output{output}, chunk_size{std::max<size_t>(chunk_size, 1)}
+{
+	chunk.reserve(this->chunk_size);
+}
+
+StreamCompressor::~StreamCompressor()
+{
+	try
+	{
+		Finish();
+	}
+	catch (const std::exception& err)
+	{
+		std::cerr << "Failed to finish the compressed stream: " << err.what() << std::endl;
+	}
+}
+
+void StreamCompressor::Write(const int* data, size_t count)
+{
+	while (count > 0)
+	{
+		size_t n = std::min(count, chunk_size - chunk.size());
+		chunk.insert(chunk.end(), data, data + n);
+		data += n;
+		count -= n;
+		if (chunk.size() == chunk_size)
+			FlushChunk();
+	}
+}
+
+void StreamCompressor::FlushChunk()
+{
+	if (chunk.empty())
+		return;
+	CompressedData frame;
+	frame.CompressParallel(chunk.cbegin(), chunk.cend());
+	frame.Write(output);
+	if (!output)
+		throw std::runtime_error("Failed to write a compressed frame");
+	frames += 1;
+	symbols += chunk.size();
+	chunk.clear();
+}
+
+void StreamCompressor::Finish()
+{
+	if (finished)
+		return;
+	finished = true;
+	FlushChunk();
+	WriteTrailer(output, frames, symbols);
+	output.flush();
+	if (!output)
+		throw std::runtime_error("Failed to write the stream trailer");
+}
+
+StreamDecompressor::StreamDecompressor(std::istream& input, size_t chunk_size)
+	: input{input}, chunk_size{std::max<size_t>(chunk_size, 1)}
+{}
+
+bool StreamDecompressor::Read(std::vector<int>& chunk)
+{
+	chunk.clear();
+	CompressedData frame;
+	if (!ReadFrame(frame))
+		return false;
+	chunk = frame.Decompress();
+	return true;
+}
+
+bool StreamDecompressor::ReadFrame(CompressedData& frame)
+{
+	if (finished)
+		return false;
+
+	char magic[4];
+	if (!input.read(magic, sizeof(magic)))
+		throw std::runtime_error("Compressed stream is truncated");
+
+	if (std::equal(std::begin(TRAILER_MAGIC), std::end(TRAILER_MAGIC), magic))
+	{
+		char trailer[TRAILER_SIZE];
+		std::memcpy(trailer, magic, sizeof(magic));
+		if (!input.read(trailer + sizeof(magic), TRAILER_SIZE - sizeof(magic)))
+			throw std::runtime_error("Compressed stream trailer is malformed");
+		CheckTrailer(trailer, frames, symbols);
+		finished = true;
+		return false;
+	}
+
+	FileFormat::FileHeader header;
+	std::memcpy(header.magic, magic, sizeof(magic));
+	input.read(reinterpret_cast<char*>(&header) + sizeof(magic), sizeof(header) - sizeof(magic));
+	if (!input || header.file_size < sizeof(header))
+		throw std::runtime_error("Compressed stream frame is malformed");
+	if (header.file_size > MaxFrameBytes(chunk_size) || header.symbol_count > chunk_size)
+		throw std::runtime_error("Compressed stream frame exceeds the chunk size");
+	if (header.file_size - sizeof(header) > RemainingBytes(input))
+		throw std::runtime_error("Compressed stream is truncated");
+
+	// Words keep the frame 8-byte aligned so it decodes in place
+	auto buffer = std::make_shared<std::vector<uint64_t>>(FileFormat::AlignUp(header.file_size) / sizeof(uint64_t));
+	auto bytes = reinterpret_cast<unsigned char*>(buffer->data());
+	std::memcpy(bytes, &header, sizeof(header));
+	input.read(reinterpret_cast<char*>(bytes) + sizeof(header), header.file_size - sizeof(header));
+	if (!input)
+		throw std::runtime_error("Compressed stream is truncated");
+
+	frame.Load(buffer, bytes, header.file_size);
+	frames += 1;
+	symbols += frame.Size();
+	return true;
+}
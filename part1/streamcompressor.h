@@ -0,0 +1,98 @@
+// Source code for Test task
+// Licensed after GNU GPL v3
+
+#ifndef STREAMCOMPRESSOR_H
+#define STREAMCOMPRESSOR_H
+
+#include <istream>
+#include <ostream>
+#include <vector>
+#include "compressor.h"
+
+// A stream is a sequence of frames, each one a CompressedData image with its
+// own dictionary (see fileformat.h), followed by a trailer:
+//
+//   char magic[4] = "HUFE", uint32_t version, uint64_t frames, uint64_t symbols
+//
+// Only one chunk of input and its frame are held in memory at a time.
+namespace StreamFormat
+{
+constexpr char TRAILER_MAGIC[4] = {'H', 'U', 'F', 'E'};
+constexpr uint32_t VERSION = 1;
+constexpr size_t TRAILER_SIZE = sizeof(TRAILER_MAGIC) + sizeof(uint32_t) + 2 * sizeof(uint64_t);
+
+void WriteTrailer(std::ostream& output, uint64_t frames, uint64_t symbols);
+
+// Checks a trailer read from data, TRAILER_SIZE bytes, against the frames
+// and symbols seen before it; throws std::runtime_error on a mismatch
+void CheckTrailer(const char* data, uint64_t frames, uint64_t symbols);
+}
+
+constexpr size_t DEFAULT_CHUNK_SIZE = size_t{1} << 22;
+
+// Largest frame image a chunk of chunk_size values may take: the worst of
+// the coders per value plus the fixed parts of the image. Decompressors
+// reject bigger frames before allocating for them.
+size_t MaxFrameBytes(size_t chunk_size);
+
+// Push-style compressor: buffers input up to chunk_size symbols and writes
+// every full chunk to the output as one frame
+class StreamCompressor
+{
+	std::ostream& output;
+	size_t chunk_size;
+	std::vector<int> chunk;
+	size_t frames{0};
+	size_t symbols{0};
+	bool finished{false};
+
+	void FlushChunk();
+
+public:
+	explicit StreamCompressor(std::ostream& output, size_t chunk_size = DEFAULT_CHUNK_SIZE);
+	~StreamCompressor();
+
+	StreamCompressor(const StreamCompressor&) = delete;
+	StreamCompressor& operator=(const StreamCompressor&) = delete;
+
+	void Write(const int* data, size_t count);
+
+	template<typename It>
+	void Write(It first, It last)
+	{
+		for (; first != last; ++first)
+		{
+			chunk.push_back(*first);
+			if (chunk.size() == chunk_size)
+				FlushChunk();
+		}
+	}
+
+	// Writes the last partial chunk and the trailer
+	void Finish();
+};
+
+// Pull-style decompressor over a stream written by StreamCompressor
+class StreamDecompressor
+{
+	std::istream& input;
+	size_t chunk_size;
+	size_t frames{0};
+	size_t symbols{0};
+	bool finished{false};
+
+public:
+	// chunk_size bounds the values of a frame, and with it the memory a
+	// frame may claim; it must be at least that of the compressor
+	explicit StreamDecompressor(std::istream& input, size_t chunk_size = DEFAULT_CHUNK_SIZE);
+
+	// Replaces chunk with the next decoded frame, returns false after the
+	// trailer. Throws std::runtime_error on a malformed stream or a frame
+	// over the chunk size.
+	bool Read(std::vector<int>& chunk);
+
+	// Like Read, but loads the next frame without decoding it
+	bool ReadFrame(CompressedData& frame);
+};
+
+#endif // STREAMCOMPRESSOR_H
@@ -0,0 +1,137 @@
+// Source code for Test task
+// Licensed after GNU GPL v3
+
+#include "threadpool.h"
+#include <algorithm>
+
+namespace HuffmanTree
+{
+
+namespace
+{
+thread_local bool inside_pool = false;
+thread_local size_t participant_index = 0;
+}
+
+size_t HardwareThreads()
+{
+	size_t hardware_conc = std::thread::hardware_concurrency();
+	return hardware_conc != 0 ? hardware_conc : 1;
+}
+
+ThreadPool::ThreadPool(size_t nthreads)
+	: ranges(new Range[std::max<size_t>(nthreads, 1)])
+{
+	for (size_t i = 1; i < nthreads; ++i)
+		workers.emplace_back(&ThreadPool::WorkerLoop, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard lock(mutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (auto& worker : workers)
+		worker.join();
+}
+
+void ThreadPool::WorkerLoop(size_t index)
+{
+	size_t seen = 0;
+	std::unique_lock lock(mutex);
+	for (;;)
+	{
+		wake.wait(lock, [&] { return stopping || generation != seen; });
+		if (stopping)
+			return;
+		seen = generation;
+		if (index >= participants)
+			continue;
+		lock.unlock();
+		Participate(index);
+		lock.lock();
+		if (--running == 0)
+			done.notify_all();
+	}
+}
+
+void ThreadPool::Participate(size_t index)
+{
+	inside_pool = true;
+	participant_index = index;
+	try
+	{
+		for (size_t k = 0; k < participants; ++k)
+		{
+			auto& range = ranges[(index + k) % participants];
+			for (size_t i = range.next.fetch_add(1); i < range.end; i = range.next.fetch_add(1))
+				(*task)(i);
+		}
+	}
+	catch (...)
+	{
+		std::lock_guard lock(mutex);
+		if (!error)
+			error = std::current_exception();
+	}
+	inside_pool = false;
+	participant_index = 0;
+}
+
+void ThreadPool::ParallelFor(size_t count, const std::function<void(size_t)>& task)
+{
+	if (count == 0)
+		return;
+	if (workers.empty() || count == 1 || inside_pool)
+	{
+		for (size_t i = 0; i < count; ++i)
+			task(i);
+		return;
+	}
+
+	std::lock_guard submit(submit_mutex);
+	size_t nparticipants = std::min(Size(), count);
+	for (size_t p = 0; p < nparticipants; ++p)
+	{
+		ranges[p].next = count * p / nparticipants;
+		ranges[p].end = count * (p + 1) / nparticipants;
+	}
+	{
+		std::lock_guard lock(mutex);
+		this->task = &task;
+		participants = nparticipants;
+		running = nparticipants - 1;
+		error = nullptr;
+		++generation;
+	}
+	wake.notify_all();
+
+	Participate(0);
+
+	std::unique_lock lock(mutex);
+	done.wait(lock, [&] { return running == 0; });
+	this->task = nullptr;
+	if (error)
+		std::rethrow_exception(error);
+}
+
+size_t ThreadPool::CurrentThread()
+{
+	return participant_index;
+}
+
+ThreadPool& ThreadPool::Default()
+{
+	static ThreadPool pool;
+	return pool;
+}
+
+ThreadPool& ThreadPool::Serial()
+{
+	static ThreadPool pool(1);
+	return pool;
+}
+
+}
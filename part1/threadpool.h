@@ -0,0 +1,78 @@
+// Source code for Test task
+// Licensed after GNU GPL v3
+
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace HuffmanTree
+{
+
+size_t HardwareThreads();
+
+// Persistent pool for index-parallel loops. ParallelFor hands every
+// participant (the workers and the calling thread) an equal range of
+// indices; a participant that runs out claims indices from the ranges of
+// the others, so uneven items balance out without a shared queue.
+class ThreadPool
+{
+	struct alignas(64) Range
+	{
+		std::atomic<size_t> next{0};
+		size_t end{0};
+	};
+
+	std::vector<std::thread> workers;
+	std::unique_ptr<Range[]> ranges;
+	const std::function<void(size_t)>* task{nullptr};
+	size_t participants{0};
+
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable done;
+	size_t generation{0};
+	size_t running{0};
+	bool stopping{false};
+	std::exception_ptr error;
+
+	std::mutex submit_mutex;
+
+	void WorkerLoop(size_t index);
+	void Participate(size_t index);
+
+public:
+	// nthreads counts the calling thread, so ThreadPool(1) starts no workers
+	explicit ThreadPool(size_t nthreads = HardwareThreads());
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	size_t Size() const { return workers.size() + 1; }
+
+	// Runs task(i) for every i in [0, count) and returns after all of them
+	// finished, rethrowing the first error. Calls from inside a task run
+	// serially on the calling thread.
+	void ParallelFor(size_t count, const std::function<void(size_t)>& task);
+
+	// Index of the calling participant inside a task, 0 for the thread that
+	// called ParallelFor and outside of tasks
+	static size_t CurrentThread();
+
+	static ThreadPool& Default();
+	// Runs everything on the calling thread
+	static ThreadPool& Serial();
+};
+
+}
+
+#endif // THREADPOOL_H
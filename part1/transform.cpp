@@ -0,0 +1,243 @@
+// Source code for Test task
+// Licensed after GNU GPL v3
+
+#include "transform.h"
+#include <algorithm>
+#include <stdexcept>
+
+namespace HuffmanTree
+{
+
+namespace
+{
+constexpr unsigned TRANSFORM_BITS = 4;
+
+int Wrap(uint32_t value)
+{
+	return static_cast<int>(value);
+}
+
+void Delta(std::vector<int>& values)
+{
+	uint32_t previous = 0;
+	for (auto& value : values)
+	{
+		uint32_t current = static_cast<uint32_t>(value);
+		value = Wrap(current - previous);
+		previous = current;
+	}
+}
+
+void UndoDelta(std::vector<int>& values)
+{
+	uint32_t previous = 0;
+	for (auto& value : values)
+	{
+		previous += static_cast<uint32_t>(value);
+		value = Wrap(previous);
+	}
+}
+
+void ZigZag(std::vector<int>& values)
+{
+	for (auto& value : values)
+	{
+		uint32_t sign = value < 0 ? ~uint32_t{0} : 0;
+		value = Wrap((static_cast<uint32_t>(value) << 1) ^ sign);
+	}
+}
+
+void UndoZigZag(std::vector<int>& values)
+{
+	for (auto& value : values)
+	{
+		uint32_t code = static_cast<uint32_t>(value);
+		value = Wrap((code >> 1) ^ (~(code & 1) + 1));
+	}
+}
+
+void RunLength(std::vector<int>& values)
+{
+	std::vector<int> runs;
+	for (size_t i = 0; i < values.size();)
+	{
+		size_t j = i + 1;
+		while (j < values.size() && values[j] == values[i] && j - i < INT32_MAX)
+			++j;
+		runs.push_back(values[i]);
+		runs.push_back(static_cast<int>(j - i));
+		i = j;
+	}
+	values = std::move(runs);
+}
+
+void UndoRunLength(std::vector<int>& values, size_t max_values)
+{
+	if (values.size() % 2 != 0)
+		throw std::runtime_error("Run-length block is malformed");
+	size_t total = 0;
+	for (size_t i = 1; i < values.size(); i += 2)
+	{
+		if (values[i] <= 0)
+			throw std::runtime_error("Run-length block is malformed");
+		total += values[i];
+	}
+	if (total > max_values)
+		throw std::runtime_error("Run-length block is malformed");
+	std::vector<int> expanded;
+	expanded.reserve(total);
+	for (size_t i = 0; i < values.size(); i += 2)
+		expanded.insert(expanded.end(), values[i + 1], values[i]);
+	values = std::move(expanded);
+}
+
+void FrameOfReference(std::vector<int>& values)
+{
+	if (values.empty())
+		return;
+	int reference = *std::min_element(values.cbegin(), values.cend());
+	for (auto& value : values)
+		value = Wrap(static_cast<uint32_t>(value) - static_cast<uint32_t>(reference));
+	values.insert(values.begin(), reference);
+}
+
+void UndoFrameOfReference(std::vector<int>& values)
+{
+	if (values.empty())
+		return;
+	uint32_t reference = static_cast<uint32_t>(values.front());
+	values.erase(values.begin());
+	for (auto& value : values)
+		value = Wrap(static_cast<uint32_t>(value) + reference);
+}
+}
+
+uint32_t PackTransforms(std::span<const Transform> transforms)
+{
+	if (transforms.size() > MAX_TRANSFORMS)
+		throw std::invalid_argument("Too many transforms");
+	uint32_t packed = 0;
+	for (size_t i = 0; i < transforms.size(); ++i)
+		packed |= uint32_t{static_cast<uint8_t>(transforms[i])} << (i * TRANSFORM_BITS);
+	return packed;
+}
+
+std::vector<Transform> UnpackTransforms(uint32_t packed)
+{
+	std::vector<Transform> result;
+	for (; packed != 0; packed >>= TRANSFORM_BITS)
+	{
+		auto transform = static_cast<Transform>(packed & ((1u << TRANSFORM_BITS) - 1));
+		if (transform < Transform::Delta || transform > Transform::FrameOfReference)
+			throw std::runtime_error("Unknown transform");
+		result.push_back(transform);
+	}
+	return result;
+}
+
+size_t MaxTransformedSize(std::span<const Transform> transforms, size_t count)
+{
+	for (auto transform : transforms)
+	{
+		// a run per value doubles them, the reference adds one; saturates
+		// rather than wraps
+		if (transform == Transform::RunLength)
+			count = count > SIZE_MAX / 2 ? SIZE_MAX : 2 * count;
+		else if (transform == Transform::FrameOfReference)
+			count = count == SIZE_MAX ? SIZE_MAX : count + 1;
+	}
+	return count;
+}
+
+void ApplyTransforms(std::span<const Transform> transforms, std::vector<int>& values)
+{
+	for (auto transform : transforms)
+	{
+		switch (transform)
+		{
+		case Transform::Delta:
+			Delta(values);
+			break;
+		case Transform::ZigZag:
+			ZigZag(values);
+			break;
+		case Transform::RunLength:
+			RunLength(values);
+			break;
+		case Transform::FrameOfReference:
+			FrameOfReference(values);
+			break;
+		default:
+			throw std::invalid_argument("Unknown transform");
+		}
+	}
+}
+
+void UndoTransforms(std::span<const Transform> transforms, std::vector<int>& values, size_t max_values)
+{
+	for (auto it = transforms.rbegin(); it != transforms.rend(); ++it)
+	{
+		switch (*it)
+		{
+		case Transform::Delta:
+			UndoDelta(values);
+			break;
+		case Transform::ZigZag:
+			UndoZigZag(values);
+			break;
+		case Transform::RunLength:
+			UndoRunLength(values, max_values);
+			break;
+		case Transform::FrameOfReference:
+			UndoFrameOfReference(values);
+			break;
+		default:
+			throw std::runtime_error("Unknown transform");
+		}
+	}
+}
+
+void UntransformBlocks(std::span<const int> decoded, std::span<const BlockInfo> blocks,
+					   std::span<const Transform> transforms, size_t block_size, size_t value_count,
+					   int* out, ThreadPool& pool)
+{
+	block_size = std::max<size_t>(block_size, 1);
+	if (blocks.size() != (value_count + block_size - 1) / block_size)
+		throw std::runtime_error("Transformed blocks do not match the value count");
+	std::vector<size_t> offsets(blocks.size());
+	size_t total = 0;
+	for (size_t i = 0; i < blocks.size(); ++i)
+	{
+		offsets[i] = total;
+		total += blocks[i].symbol_count;
+	}
+	if (total != decoded.size())
+		throw std::runtime_error("Transformed blocks do not match the value count");
+
+	// no stage of a valid block is longer than this, so corrupted run
+	// lengths cannot blow up memory
+	size_t max_values = block_size;
+	for (auto transform : transforms)
+		max_values = transform == Transform::RunLength ? 2 * max_values : max_values + 1;
+
+	pool.ParallelFor(blocks.size(), [&](size_t i)
+	{
+		auto begin = decoded.begin() + offsets[i];
+		std::vector<int> block(begin, begin + blocks[i].symbol_count);
+		UndoTransforms(transforms, block, max_values);
+		if (block.size() != std::min(block_size, value_count - i * block_size))
+			throw std::runtime_error("Transformed block restores a wrong number of values");
+		std::copy(block.cbegin(), block.cend(), out + i * block_size);
+	});
+}
+
+std::vector<int> UntransformBlocks(const std::vector<int>& decoded, std::span<const BlockInfo> blocks,
+								   std::span<const Transform> transforms, size_t block_size,
+								   size_t value_count, ThreadPool& pool)
+{
+	std::vector<int> result(value_count);
+	UntransformBlocks(decoded, blocks, transforms, block_size, value_count, result.data(), pool);
+	return result;
+}
+
+}
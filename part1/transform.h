@@ -0,0 +1,98 @@
+// Source code for Test task
+// Licensed after GNU GPL v3
+
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include <cstdint>
+#include <iterator>
+#include <span>
+#include <vector>
+#include "bitstream.h"
+#include "threadpool.h"
+
+namespace HuffmanTree
+{
+
+// Reversible integer transforms applied to every block before entropy
+// coding, so that sorted IDs, counters and slowly changing values turn into
+// small, repetitive symbols. All arithmetic wraps modulo 2^32.
+enum class Transform : uint8_t
+{
+	Delta = 1,              // differences to the previous value
+	ZigZag,                 // small negative values to small positive ones
+	RunLength,              // (value, run length) pairs
+	FrameOfReference,       // block minimum, then offsets from it
+};
+
+constexpr size_t MAX_TRANSFORMS = 8;
+
+// Four bits per step in order of application, for the file header; unpack
+// throws std::runtime_error on an unknown transform
+uint32_t PackTransforms(std::span<const Transform> transforms);
+std::vector<Transform> UnpackTransforms(uint32_t packed);
+
+// Most values the transforms turn count values into
+size_t MaxTransformedSize(std::span<const Transform> transforms, size_t count);
+
+// Applies the transforms to one block in order, and undoes them in reverse.
+// UndoTransforms throws std::runtime_error on malformed input or when a run
+// length expands past max_values.
+void ApplyTransforms(std::span<const Transform> transforms, std::vector<int>& values);
+void UndoTransforms(std::span<const Transform> transforms, std::vector<int>& values,
+					size_t max_values = SIZE_MAX);
+
+struct TransformedBlocks
+{
+	std::vector<int> values;        // transformed blocks back to back
+	std::vector<size_t> counts;     // transformed length of every block
+};
+
+// Transforms every block_size values of the input on the pool
+template<std::random_access_iterator It>
+TransformedBlocks TransformBlocks(It first, It last, std::span<const Transform> transforms,
+								  size_t block_size, ThreadPool& pool)
+{
+	size_t length = std::distance(first, last);
+	block_size = std::max<size_t>(block_size, 1);
+	size_t nblocks = (length + block_size - 1) / block_size;
+
+	std::vector<std::vector<int>> blocks(nblocks);
+	pool.ParallelFor(nblocks, [&](size_t i)
+	{
+		auto begin = first + i * block_size;
+		blocks[i].assign(begin, begin + std::min(block_size, length - i * block_size));
+		ApplyTransforms(transforms, blocks[i]);
+	});
+
+	TransformedBlocks result;
+	result.counts.resize(nblocks);
+	std::vector<size_t> offsets(nblocks);
+	size_t total = 0;
+	for (size_t i = 0; i < nblocks; ++i)
+	{
+		offsets[i] = total;
+		result.counts[i] = blocks[i].size();
+		total += blocks[i].size();
+	}
+	result.values.resize(total);
+	pool.ParallelFor(nblocks, [&](size_t i)
+	{
+		std::copy(blocks[i].cbegin(), blocks[i].cend(), result.values.begin() + offsets[i]);
+	});
+	return result;
+}
+
+// Undoes TransformBlocks for the decoded blocks, each of which must restore
+// block_size values except the last, writing value_count values to out
+void UntransformBlocks(std::span<const int> decoded, std::span<const BlockInfo> blocks,
+					   std::span<const Transform> transforms, size_t block_size, size_t value_count,
+					   int* out, ThreadPool& pool);
+
+std::vector<int> UntransformBlocks(const std::vector<int>& decoded, std::span<const BlockInfo> blocks,
+								   std::span<const Transform> transforms, size_t block_size,
+								   size_t value_count, ThreadPool& pool);
+
+}
+
+#endif // TRANSFORM_H
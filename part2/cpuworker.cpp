@@ -0,0 +1,301 @@
+// Source code for Test task
+// Licensed after GNU GPL v3
+
+#include "cpuworker.h"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <climits>
+#include <memory>
+#include <numeric>
+#include <thread>
+
+namespace
+{
+using Word = uint64_t;
+constexpr size_t WORD_BITS = 64;
+// fewer values per thread cost more to start than the thread saves
+constexpr size_t MIN_VALUES_PER_THREAD = size_t{1} << 16;
+// bytes of private counters of all threads together; beyond it fewer
+// threads count
+constexpr size_t PRIVATE_MEMORY_BUDGET = size_t{1} << 30;
+// Auto takes the bitmaps up to this much range per value, where merging
+// them is about as costly as partitioning and sorting the data
+constexpr uint64_t DENSE_RANGE_PER_VALUE = 8;
+// and always up to this range
+constexpr uint64_t DENSE_MIN_RANGE = uint64_t{1} << 16;
+// values of a radix bucket that stay in cache while it is sorted
+constexpr size_t BUCKET_VALUES = size_t{1} << 14;
+// more buckets scatter into more cache lines at once than the cache holds
+constexpr int MAX_RADIX_BITS = 12;
+
+// [first, last) of part of parts equal slices of size items
+std::pair<size_t, size_t> Slice(size_t size, size_t parts, size_t part)
+{
+	return {size / parts * part + std::min(part, size % parts),
+			size / parts * (part + 1) + std::min(part + 1, size % parts)};
+}
+
+// Calls function(thread) for thread in [0, threads), the first on the
+// calling thread
+template<typename Function>
+void RunThreads(size_t threads, const Function& function)
+{
+	std::vector<std::thread> workers;
+	workers.reserve(threads - 1);
+	for (size_t thread = 1; thread < threads; ++thread)
+		workers.emplace_back(function, thread);
+	function(size_t{0});
+	for (auto& worker : workers)
+		worker.join();
+}
+
+// Calls count(first, last) on parts slices of [0, size), then
+// write(first, last, out) with out past the values of the previous slices,
+// so that every slice writes its share of the result without locks
+template<typename Count, typename Write>
+std::vector<int> CompactSlices(size_t parts, size_t size, const Count& count, const Write& write)
+{
+	std::vector<size_t> offsets(parts + 1, 0);
+	RunThreads(parts, [&](size_t part)
+	{
+		auto [first, last] = Slice(size, parts, part);
+		offsets[part + 1] = count(first, last);
+	});
+	std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+	std::vector<int> result(offsets.back());
+	RunThreads(parts, [&](size_t part)
+	{
+		auto [first, last] = Slice(size, parts, part);
+		write(first, last, result.data() + offsets[part]);
+	});
+	return result;
+}
+
+// Radix of the value with the sign bit flipped, so that buckets follow the
+// order of the values
+uint32_t Bucket(int value, int shift)
+{
+	return (static_cast<uint32_t>(value) ^ 0x80000000u) >> shift;
+}
+}
+
+CPUWorker::CPUWorker(size_t threads) :
+	threads(threads != 0 ? threads : std::max(1u, std::thread::hardware_concurrency()))
+{
+}
+
+size_t CPUWorker::Threads() const
+{
+	return threads;
+}
+
+size_t CPUWorker::ThreadsFor(size_t size) const
+{
+	return std::clamp<size_t>(size / MIN_VALUES_PER_THREAD, 1, threads);
+}
+
+std::vector<int> CPUWorker::SearchBitmaps(const int* data, size_t data_size, int64_t min_value, uint64_t range) const
+{
+	size_t words = (range + WORD_BITS - 1) / WORD_BITS;
+	size_t bitmap_bytes = 2 * words * sizeof(Word);
+	size_t counters = std::min(ThreadsFor(data_size), std::max<size_t>(1, PRIVATE_MEMORY_BUDGET / bitmap_bytes));
+	// left uninitialized, every thread clears its own
+	std::unique_ptr<Word[]> once(new Word[counters * words]);
+	std::unique_ptr<Word[]> more(new Word[counters * words]);
+
+	RunThreads(counters, [&](size_t thread)
+	{
+		Word* seen = once.get() + thread * words;
+		Word* repeated = more.get() + thread * words;
+		std::fill(seen, seen + words, 0);
+		std::fill(repeated, repeated + words, 0);
+		auto [first, last] = Slice(data_size, counters, thread);
+		for (size_t i = first; i < last; ++i)
+		{
+			uint64_t bin = static_cast<uint64_t>(data[i] - min_value);
+			if (bin >= range)
+				continue;
+			Word bit = Word{1} << (bin % WORD_BITS);
+			repeated[bin / WORD_BITS] |= seen[bin / WORD_BITS] & bit;
+			seen[bin / WORD_BITS] |= bit;
+		}
+	});
+
+	// every part merges the counters of all threads over its own words into
+	// those of the first thread, leaving the values seen once there
+	return CompactSlices(ThreadsFor(words * counters), words, [&](size_t first, size_t last)
+	{
+		size_t count = 0;
+		for (size_t word = first; word < last; ++word)
+		{
+			Word seen = once[word];
+			Word repeated = more[word];
+			for (size_t thread = 1; thread < counters; ++thread)
+			{
+				Word other = once[thread * words + word];
+				repeated |= more[thread * words + word] | (seen & other);
+				seen |= other;
+			}
+			once[word] = seen & ~repeated;
+			count += std::popcount(once[word]);
+		}
+		return count;
+	},
+	[&](size_t first, size_t last, int* out)
+	{
+		for (size_t word = first; word < last; ++word)
+			for (Word bits = once[word]; bits != 0; bits &= bits - 1)
+				*out++ = static_cast<int>(min_value + static_cast<int64_t>(word * WORD_BITS + std::countr_zero(bits)));
+	});
+}
+
+std::vector<int> CPUWorker::SearchPartitions(const int* data, size_t data_size) const
+{
+	size_t workers = ThreadsFor(data_size);
+	int radix_bits = std::clamp(static_cast<int>(std::bit_width(std::max(data_size / BUCKET_VALUES, 4 * workers))),
+								1, MAX_RADIX_BITS);
+	size_t buckets = size_t{1} << radix_bits;
+	int shift = 32 - radix_bits;
+
+	// offsets[thread * buckets + bucket]: the values of the bucket in the
+	// slice of the thread, then where the thread writes them
+	std::vector<size_t> offsets(workers * buckets, 0);
+	RunThreads(workers, [&](size_t thread)
+	{
+		size_t* counts = offsets.data() + thread * buckets;
+		auto [first, last] = Slice(data_size, workers, thread);
+		for (size_t i = first; i < last; ++i)
+			++counts[Bucket(data[i], shift)];
+	});
+	std::vector<size_t> starts(buckets + 1);
+	size_t total = 0;
+	for (size_t bucket = 0; bucket < buckets; ++bucket)
+	{
+		starts[bucket] = total;
+		for (size_t thread = 0; thread < workers; ++thread)
+			total += std::exchange(offsets[thread * buckets + bucket], total);
+	}
+	starts[buckets] = total;
+
+	std::unique_ptr<int[]> partitioned(new int[data_size]);
+	RunThreads(workers, [&](size_t thread)
+	{
+		size_t* next = offsets.data() + thread * buckets;
+		auto [first, last] = Slice(data_size, workers, thread);
+		for (size_t i = first; i < last; ++i)
+			partitioned[next[Bucket(data[i], shift)]++] = data[i];
+	});
+
+	// threads take the buckets in turn, sort each and move the values seen
+	// once to its front; buckets vary in size, so none is assigned up front
+	std::vector<size_t> unique_counts(buckets);
+	std::atomic<size_t> next_bucket{0};
+	RunThreads(workers, [&](size_t)
+	{
+		for (size_t bucket; (bucket = next_bucket.fetch_add(1, std::memory_order_relaxed)) < buckets;)
+		{
+			int* first = partitioned.get() + starts[bucket];
+			int* last = partitioned.get() + starts[bucket + 1];
+			std::sort(first, last);
+			int* out = first;
+			for (int* it = first; it != last;)
+			{
+				int* run = it;
+				while (++it != last && *it == *run)
+					;
+				if (it - run == 1)
+					*out++ = *run;
+			}
+			unique_counts[bucket] = out - first;
+		}
+	});
+
+	return CompactSlices(ThreadsFor(total), buckets, [&](size_t first, size_t last)
+	{
+		return std::accumulate(unique_counts.begin() + first, unique_counts.begin() + last, size_t{0});
+	},
+	[&](size_t first, size_t last, int* out)
+	{
+		for (size_t bucket = first; bucket < last; ++bucket)
+			out = std::copy_n(partitioned.get() + starts[bucket], unique_counts[bucket], out);
+	});
+}
+
+std::pair<std::vector<int>, std::vector<int>>
+CPUWorker::SearchHistogram(const int* data, size_t data_size, int hist_size) const
+{
+	size_t bins = static_cast<size_t>(hist_size);
+	size_t counters = std::min(ThreadsFor(data_size), std::max<size_t>(1, PRIVATE_MEMORY_BUDGET / (bins * sizeof(int))));
+	std::unique_ptr<int[]> histograms(new int[counters * bins]);
+	RunThreads(counters, [&](size_t thread)
+	{
+		int* histogram = histograms.get() + thread * bins;
+		std::fill(histogram, histogram + bins, 0);
+		auto [first, last] = Slice(data_size, counters, thread);
+		for (size_t i = first; i < last; ++i)
+			if (static_cast<unsigned>(data[i]) < bins)
+				++histogram[data[i]];
+	});
+
+	std::vector<int> histogram(bins);
+	auto unique = CompactSlices(ThreadsFor(bins * counters), bins, [&](size_t first, size_t last)
+	{
+		size_t count = 0;
+		for (size_t bin = first; bin < last; ++bin)
+		{
+			int sum = 0;
+			for (size_t thread = 0; thread < counters; ++thread)
+				sum += histograms[thread * bins + bin];
+			histogram[bin] = sum;
+			count += sum == 1;
+		}
+		return count;
+	},
+	[&](size_t first, size_t last, int* out)
+	{
+		for (size_t bin = first; bin < last; ++bin)
+			if (histogram[bin] == 1)
+				*out++ = static_cast<int>(bin);
+	});
+	return {std::move(unique), std::move(histogram)};
+}
+
+std::pair<std::vector<int>, std::vector<int>>
+CPUWorker::SearchUnique(const int* data, size_t data_size, int hist_size, bool return_histogram) const
+{
+	if (hist_size <= 0)
+		return {};
+	if (return_histogram)
+		return SearchHistogram(data, data_size, hist_size);
+	return {SearchBitmaps(data, data_size, 0, static_cast<uint64_t>(hist_size)), {}};
+}
+
+std::vector<int> CPUWorker::FindUnique(const int* data, size_t data_size, UniqueMode mode) const
+{
+	if (data_size == 0)
+		return {};
+	size_t workers = ThreadsFor(data_size);
+	std::vector<std::pair<int, int>> bounds(workers);
+	RunThreads(workers, [&](size_t thread)
+	{
+		auto [first, last] = Slice(data_size, workers, thread);
+		auto [lowest, highest] = std::minmax_element(data + first, data + last);
+		bounds[thread] = {*lowest, *highest};
+	});
+	int lowest = INT_MAX;
+	int highest = INT_MIN;
+	for (auto [low, high] : bounds)
+	{
+		lowest = std::min(lowest, low);
+		highest = std::max(highest, high);
+	}
+	uint64_t range = static_cast<uint64_t>(int64_t{highest} - lowest + 1);
+
+	if (mode == UniqueMode::Auto)
+		mode = range <= std::max<uint64_t>(DENSE_MIN_RANGE, DENSE_RANGE_PER_VALUE * data_size) ? UniqueMode::Dense
+																							   : UniqueMode::Sparse;
+	if (mode == UniqueMode::Dense)
+		return SearchBitmaps(data, data_size, lowest, range);
+	return SearchPartitions(data, data_size);
+}
@@ -0,0 +1,53 @@
+// Source code for Test task
+// Licensed after GNU GPL v3
+
+#ifndef CPUWORKER_H
+#define CPUWORKER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "uniquemode.h"
+
+// The unique search of OCLWorker on the CPU, over every core and without
+// OpenCL. Each search splits the data between std::threads that count
+// privately and merge without locks.
+class CPUWorker
+{
+	size_t threads;
+
+	// Threads worth starting for size items of work
+	size_t ThreadsFor(size_t size) const;
+
+	// Values of data in [min_value, min_value + range) that occur once, from
+	// a pair of bitmaps per thread: seen once and seen more, a 2-bit
+	// saturating counter per value
+	std::vector<int> SearchBitmaps(const int* data, size_t data_size, int64_t min_value, uint64_t range) const;
+	// Values of data that occur once, from a radix partition of the data by
+	// its high bits, whose buckets are then sorted independently
+	std::vector<int> SearchPartitions(const int* data, size_t data_size) const;
+	// Values of data in [0, hist_size) that occur once and their histogram,
+	// from int histograms per thread
+	std::pair<std::vector<int>, std::vector<int>>
+	SearchHistogram(const int* data, size_t data_size, int hist_size) const;
+
+public:
+	// threads 0 takes std::thread::hardware_concurrency()
+	explicit CPUWorker(size_t threads = 0);
+
+	// Values of data in [0, hist_size) that occur exactly once, in ascending
+	// order, and the histogram, which stays empty unless return_histogram.
+	// Values outside the histogram are skipped. Without the histogram only
+	// 2 bits per bin and thread are kept, a sixteenth of an int histogram.
+	std::pair<std::vector<int>, std::vector<int>>
+	SearchUnique(const int* data, size_t data_size, int hist_size, bool return_histogram = true) const;
+
+	// Values of data that occur exactly once, in ascending order, over the
+	// whole int range
+	std::vector<int> FindUnique(const int* data, size_t data_size, UniqueMode mode = UniqueMode::Auto) const;
+
+	size_t Threads() const;
+};
+
+#endif // CPUWORKER_H
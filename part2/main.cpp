@@ -9,6 +9,7 @@
 #include <random>
 #include <cassert>
 #include <climits>
+#include "cpuworker.h"
 #include "oclworker.h"
 
 
@@ -78,14 +79,13 @@ void TestGenerate(size_t size, int unique_count)
 		std::cout << "TestGenerate " << size << " " << unique_count << ": WRONG" << std::endl;
 }
 
-void TestGPUSearchUnique1()
+void TestGPUSearchUnique1(OCLWorker& gpu_worker)
 {
 	cl::vector<cl_int> data{ 2, 3, 2, 4, 4, 5, 6, 7, 8, 5 };
 	cl::vector<cl_int> expected{ 3, 6, 7, 8 };
 	cl_int hist_size = 9;
 	auto cpu_hist = MakeHistOnCPU(data.cbegin(), data.cend(), hist_size);
 
-	OCLWorker gpu_worker;
 	auto [gpu_result, gpu_hist] = gpu_worker.SearchUnique(data.data(), data.size(), hist_size);
 
 	if (cpu_hist == gpu_hist)
@@ -100,14 +100,13 @@ void TestGPUSearchUnique1()
 }
 
 
-void TestGPUSearchUnique2(size_t size, int unique_count)
+void TestGPUSearchUnique2(OCLWorker& gpu_worker, size_t size, int unique_count)
 {
 	auto data = GenerateWithUnique<cl::vector<cl_int>>(size, unique_count, unique_count + 10);
 	auto cpu_result = FindUniqueOnCPU(data);
 	cl_int hist_size = 1 + *std::max_element(data.cbegin(), data.cend());
 	auto cpu_hist = MakeHistOnCPU(data.cbegin(), data.cend(), hist_size);
 
-	OCLWorker gpu_worker;
 	auto [gpu_result, gpu_hist] = gpu_worker.SearchUnique(data.data(), data.size(), hist_size);
 
 //	std::copy(gpu_result.cbegin(), gpu_result.cend(), std::ostream_iterator<int>(std::cout, " "));
@@ -124,29 +123,173 @@ void TestGPUSearchUnique2(size_t size, int unique_count)
 		std::cout << "TestGPUSearchUnique2 " << size << " " << unique_count << ": result WRONG" << std::endl;
 }
 
-int main() try
+void TestGPUSearchUniqueWithoutHist(OCLWorker& gpu_worker, size_t size, int unique_count)
 {
+	auto data = GenerateWithUnique<cl::vector<cl_int>>(size, unique_count, unique_count * 4);
+	auto cpu_result = FindUniqueOnCPU(data);
+	cl_int hist_size = 1 + *std::max_element(data.cbegin(), data.cend());
+
+	auto [gpu_result, gpu_hist] = gpu_worker.SearchUnique(data.data(), data.size(), hist_size, false);
+
+	if (cpu_result == gpu_result && gpu_hist.empty())
+		std::cout << "TestGPUSearchUniqueWithoutHist " << size << " " << unique_count << ": OK" << std::endl;
+	else
+		std::cout << "TestGPUSearchUniqueWithoutHist " << size << " " << unique_count << ": WRONG" << std::endl;
+}
+
+// A histogram of several local memory tiles, each counted in its own pass
+void TestGPUSearchUniqueTiled(OCLWorker& gpu_worker, size_t size, size_t tiles)
+{
+	size_t local_bins = gpu_worker.LocalBins();
+	// large local memories get as many values as they need, an even count
+	// as GenerateWithUnique wants with the even unique count below
+	size = std::max(size, 4 * tiles * local_bins);
+	size += size % 2;
+	std::cout << "TestGPUSearchUniqueTiled " << size << " " << tiles << " tiles of " << local_bins;
+	if (local_bins == 0 || tiles * local_bins > INT_MAX / 4)
+	{
+		std::cout << ": skipped, the tiles do not fit" << std::endl;
+		return;
+	}
+	// the last tile is about half full, a quarter of the values are unique
+	int max_value = static_cast<int>(tiles * local_bins - local_bins / 2);
+	int unique_count = max_value / 8 * 2;
+	auto data = GenerateWithUnique<cl::vector<cl_int>>(size, unique_count, max_value);
+	auto cpu_result = FindUniqueOnCPU(data);
+	cl_int hist_size = 1 + *std::max_element(data.cbegin(), data.cend());
+	auto cpu_hist = MakeHistOnCPU(data.cbegin(), data.cend(), hist_size);
+
+	auto [gpu_result, gpu_hist] = gpu_worker.SearchUnique(data.data(), data.size(), hist_size);
+
+	if (cpu_hist == gpu_hist && cpu_result == gpu_result)
+		std::cout << ": OK" << std::endl;
+	else
+		std::cout << ": WRONG" << std::endl;
+}
+
+// Values up to max_value, optionally shifted to [INT_MIN, INT_MIN + max_value],
+// streamed to the device in chunks of chunk_size values
+void TestGPUFindUnique(OCLWorker& gpu_worker, size_t size, int unique_count, int max_value, bool negative,
+					   UniqueMode mode, size_t chunk_size = 0)
+{
+	auto data = GenerateWithUnique<cl::vector<cl_int>>(size, unique_count, max_value);
+	if (negative)
+		for (auto& value : data)
+			value = static_cast<cl_int>(static_cast<unsigned>(value) + static_cast<unsigned>(INT_MIN));
+	auto cpu_result = FindUniqueOnCPU(data);
+
+	auto gpu_result = gpu_worker.FindUnique(data.data(), data.size(), mode, chunk_size);
+
+	const char* names[] = {"auto", "dense", "sparse"};
+	std::cout << "TestGPUFindUnique " << size << " " << unique_count << " " << max_value
+			  << (negative ? " negative " : " ") << names[static_cast<int>(mode)];
+	if (chunk_size != 0)
+		std::cout << " chunks of " << chunk_size;
+	if (cpu_result == gpu_result)
+		std::cout << ": OK" << std::endl;
+	else
+		std::cout << ": WRONG" << std::endl;
+}
+
+bool TestCPUSearchUnique(CPUWorker& cpu_worker, size_t size, int unique_count, bool return_histogram)
+{
+	auto data = GenerateWithUnique<cl::vector<cl_int>>(size, unique_count, unique_count * 4);
+	auto cpu_result = FindUniqueOnCPU(data);
+	cl_int hist_size = 1 + *std::max_element(data.cbegin(), data.cend());
+	auto cpu_hist = return_histogram ? MakeHistOnCPU(data.cbegin(), data.cend(), hist_size) : cl::vector<cl_int>{};
+
+	auto [result, hist] = cpu_worker.SearchUnique(data.data(), data.size(), hist_size, return_histogram);
+
+	std::cout << "TestCPUSearchUnique " << size << " " << unique_count << (return_histogram ? " hist" : "");
+	bool ok = cpu_result == result && cpu_hist == hist;
+	std::cout << (ok ? ": OK" : ": WRONG") << std::endl;
+	return ok;
+}
+
+// Values up to max_value, optionally shifted to [INT_MIN, INT_MIN + max_value]
+bool TestCPUFindUnique(CPUWorker& cpu_worker, size_t size, int unique_count, int max_value, bool negative,
+					   UniqueMode mode)
+{
+	auto data = GenerateWithUnique<cl::vector<cl_int>>(size, unique_count, max_value);
+	if (negative)
+		for (auto& value : data)
+			value = static_cast<cl_int>(static_cast<unsigned>(value) + static_cast<unsigned>(INT_MIN));
+	auto cpu_result = FindUniqueOnCPU(data);
+
+	auto result = cpu_worker.FindUnique(data.data(), data.size(), mode);
+
+	const char* names[] = {"auto", "dense", "sparse"};
+	std::cout << "TestCPUFindUnique " << size << " " << unique_count << " " << max_value
+			  << (negative ? " negative " : " ") << names[static_cast<int>(mode)];
+	bool ok = cpu_result == result;
+	std::cout << (ok ? ": OK" : ": WRONG") << std::endl;
+	return ok;
+}
+
+void TestGPU(OCLWorker& gpu_worker)
+{
+	TestGPUSearchUnique1(gpu_worker);
+	TestGPUSearchUnique2(gpu_worker, 100, 10);
+	TestGPUSearchUnique2(gpu_worker, 200, 10);
+	TestGPUSearchUnique2(gpu_worker, 1'000, 10);
+	TestGPUSearchUnique2(gpu_worker, 10'000, 500);
+	TestGPUSearchUnique2(gpu_worker, 20'000, 1'000);
+	TestGPUSearchUnique2(gpu_worker, 100'000, 1'000);
+	TestGPUSearchUnique2(gpu_worker, 1'000'000, 1'000);
+	TestGPUSearchUnique2(gpu_worker, 10'000'000, 1'000);
+	TestGPUSearchUniqueWithoutHist(gpu_worker, 1'000'000, 100'000);
+	TestGPUSearchUniqueTiled(gpu_worker, 1'000'000, 2);
+	TestGPUSearchUniqueTiled(gpu_worker, 1'000'000, 5);
+	TestGPUFindUnique(gpu_worker, 1'000'000, 1'000, 2'000, true, UniqueMode::Auto);
+	TestGPUFindUnique(gpu_worker, 1'000'000, 1'000, 2'000, true, UniqueMode::Sparse);
+	TestGPUFindUnique(gpu_worker, 1'000'000, 1'000, INT_MAX, false, UniqueMode::Auto);
+	TestGPUFindUnique(gpu_worker, 1'000'000, 1'000, INT_MAX, true, UniqueMode::Sparse);
+	TestGPUFindUnique(gpu_worker, 10'000'000, 1'000, INT_MAX, false, UniqueMode::Auto);
+	TestGPUFindUnique(gpu_worker, 1'000'000, 1'000, 2'000, false, UniqueMode::Dense, 100'003);
+	TestGPUFindUnique(gpu_worker, 1'000'000, 1'000, INT_MAX, true, UniqueMode::Sparse, 100'003);
+}
+
+// Usage: unique_finder [gpu|cpu|any]
+int main(int argc, char* argv[]) try
+{
+	DeviceType device_type = argc > 1 ? ParseDeviceType(argv[1]) : DeviceType::Any;
 	TestGenerate(100, 10);
 	TestGenerate(100, 10);
 	TestGenerate(200, 10);
 	TestGenerate(1'000, 10);
 	TestGenerate(10'000'000, 1'000);
-	TestGPUSearchUnique1();
-	TestGPUSearchUnique2(100, 10);
-	TestGPUSearchUnique2(200, 10);
-	TestGPUSearchUnique2(1'000, 10);
-	TestGPUSearchUnique2(10'000, 500);
-	TestGPUSearchUnique2(20'000, 1'000);
-	TestGPUSearchUnique2(100'000, 1'000);
-	TestGPUSearchUnique2(1'000'000, 1'000);
-	TestGPUSearchUnique2(10'000'000, 1'000);
-	return 0;
+	// all cores, no OpenCL device needed; these decide the exit status
+	CPUWorker cpu_worker;
+	bool cpu_ok = true;
+	cpu_ok &= TestCPUSearchUnique(cpu_worker, 1'000'000, 100'000, true);
+	cpu_ok &= TestCPUSearchUnique(cpu_worker, 1'000'000, 100'000, false);
+	cpu_ok &= TestCPUFindUnique(cpu_worker, 1'000'000, 1'000, 2'000, true, UniqueMode::Auto);
+	cpu_ok &= TestCPUFindUnique(cpu_worker, 1'000'000, 1'000, 2'000, false, UniqueMode::Sparse);
+	cpu_ok &= TestCPUFindUnique(cpu_worker, 1'000'000, 1'000, INT_MAX, true, UniqueMode::Auto);
+	cpu_ok &= TestCPUFindUnique(cpu_worker, 10'000'000, 1'000, INT_MAX, false, UniqueMode::Sparse);
+	cpu_ok &= TestCPUFindUnique(cpu_worker, 10'000'000, 1'000, INT_MAX, false, UniqueMode::Dense);
+	try
+	{
+		// built once, the program comes from the binary cache on later runs
+		OCLWorker gpu_worker(device_type);
+		TestGPU(gpu_worker);
+	}
+	catch (NoDeviceError &err)
+	{
+		std::cout << err.what() << ", GPU tests skipped" << std::endl;
+	}
+	return cpu_ok ? 0 : 1;
 }
 catch (cl::Error &err)
 {
 	std::cerr << "OCL ERROR " << err.err() << ":" << err.what() << std::endl;
 	return -1;
 }
+catch (std::invalid_argument &err)
+{
+	std::cerr << err.what() << ", usage: unique_finder [gpu|cpu|any]" << std::endl;
+	return -1;
+}
 catch (std::runtime_error &err)
 {
 	std::cerr << "RUNTIME ERROR " << err.what() << std::endl;
@@ -2,146 +2,663 @@
 // Licensed after GNU GPL v3
 
 #include "oclworker.h"
+#include <algorithm>
 #include <cassert>
+#include <climits>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <stdexcept>
 
 #define STRINGIFY(...) #__VA_ARGS__
 
 // ---------------------------------- OpenCL ---------------------------------
 const char *findUniqueValues = STRINGIFY(
-__kernel void histogram(__global int *data, int num_data,
-						__global int *histogram, int num_bins
-						//,__global int *result, volatile __global int *count
-						)
+// Bins are values minus min_value in unsigned arithmetic, so that values
+// below min_value wrap past the last bin and are skipped like those above.
+
+// One atomic per element straight into the global histogram; the fallback
+// for histograms too large for local memory
+__kernel void histogram_global(__global const int *data, int num_data,
+							   __global int *histogram, int num_bins, int min_value)
 {
 	int i;
-//	int lid = get_local_id(0);
 	int gid = get_global_id(0);
-//	int lsize = get_local_size(0);
 	int gsize = get_global_size(0);
 
-	barrier(CLK_GLOBAL_MEM_FENCE);
-	for (i = gid; i < num_bins; i += gsize)
-		histogram[i] = 0;
+	for (i = gid; i < num_data; i += gsize)
+	{
+		uint bin = as_uint(data[i]) - as_uint(min_value);
+		if (bin < (uint)num_bins)
+			atomic_add(&histogram[bin], 1);
+	}
+}
+
+// Counts the bins [bin_offset, bin_offset + num_bins) of the histogram in
+// a private copy per work-group in local memory, then adds the nonzero
+// bins to the global histogram. Hot bins only contend within a group.
+__kernel void histogram_local(__global const int *data, int num_data,
+							  __global int *histogram, int num_bins, int bin_offset, int min_value,
+							  __local int *local_histogram)
+{
+	int i;
+	int lid = get_local_id(0);
+	int lsize = get_local_size(0);
+	int gid = get_global_id(0);
+	int gsize = get_global_size(0);
+
+	for (i = lid; i < num_bins; i += lsize)
+		local_histogram[i] = 0;
+	barrier(CLK_LOCAL_MEM_FENCE);
 
-	barrier(CLK_GLOBAL_MEM_FENCE);
 	for (i = gid; i < num_data; i += gsize)
-		atomic_add(&histogram[data[i]], 1);
-
-//	TODO: Data race somewhere, "return" only histogram
-//	barrier(CLK_GLOBAL_MEM_FENCE);
-//	count[0] = 0;
-
-//	barrier(CLK_GLOBAL_MEM_FENCE);
-//	for (i = gid; i < num_bins; i += gsize)
-//		result[i] = 0;
-
-//	barrier(CLK_GLOBAL_MEM_FENCE);
-//	if(get_global_id(0) == 0)
-//	{
-//		//printf("get_global_id(0): %i", get_global_id(0));
-//		for (i = 0; i < num_bins; i += 1)
-//		{
-//			if (histogram[i] == 1)
-//			{
-//				atomic_xchg(&result[*count], i);
-//				atomic_inc(count);
-//				//printf("Counter: %i", *count);
-//			}
-//		}
-//	}
+	{
+		uint bin = as_uint(data[i]) - as_uint(min_value) - (uint)bin_offset;
+		if (bin < (uint)num_bins)
+			atomic_inc(&local_histogram[bin]);
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (i = lid; i < num_bins; i += lsize)
+	{
+		int count = local_histogram[i];
+		if (count != 0)
+			atomic_add(&histogram[bin_offset + i], count);
+	}
 }
-);
-// ---------------------------------- OpenCL ---------------------------------
 
+// Counts every value in an open-addressing table of 2^bits slots with
+// linear probing. Empty slots hold the key INT_MIN, so that value is
+// counted in count[1] instead; count[2] is set when a value finds no slot.
+// Counts stop being incremented at 2, only once and more than once
+// matter; a stale read can only overshoot.
+__kernel void hash_count(__global const int *data, int num_data, __global int *keys,
+						 volatile __global int *counts, int bits, volatile __global int *count)
+{
+	int i;
+	int gid = get_global_id(0);
+	int gsize = get_global_size(0);
+	uint mask = (1u << bits) - 1;
 
-OCLWorker::OCLWorker()
-	: platform(SelectPlatform())
-	, context(GetGpuContext(platform()))
-	, command_queue(context)
+	for (i = gid; i < num_data; i += gsize)
+	{
+		int value = data[i];
+		uint slot;
+		uint probe;
+		if (value == INT_MIN)
+		{
+			if (count[1] < 2)
+				atomic_inc(&count[1]);
+			continue;
+		}
+		slot = (as_uint(value) * 2654435769u) >> (32 - bits);
+		for (probe = 0; probe <= mask; ++probe)
+		{
+			int key = atomic_cmpxchg(&keys[slot], INT_MIN, value);
+			if (key == INT_MIN || key == value)
+			{
+				if (counts[slot] < 2)
+					atomic_inc(&counts[slot]);
+				break;
+			}
+			slot = (slot + 1) & mask;
+		}
+		if (probe > mask)
+			count[2] = 1;
+	}
+}
+
+// Inclusive scan of one value per work-item of the group, which must all
+// call it; scratch holds one int per work-item
+int scan_group(int value, __local int *scratch)
 {
-	cl::string name = platform.getInfo<CL_PLATFORM_NAME>();
-	cl::string profile = platform.getInfo<CL_PLATFORM_PROFILE>();
-	std::cout << "Selected: " << name << ": " << profile << std::endl;
+	int lid = get_local_id(0);
+	int offset;
+	barrier(CLK_LOCAL_MEM_FENCE);
+	scratch[lid] = value;
+	barrier(CLK_LOCAL_MEM_FENCE);
+	for (offset = 1; offset < get_local_size(0); offset *= 2)
+	{
+		int add = lid >= offset ? scratch[lid - offset] : 0;
+		barrier(CLK_LOCAL_MEM_FENCE);
+		scratch[lid] += add;
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	return scratch[lid];
+}
+
+// Stream compaction of the bins with histogram[i] == 1 in three steps.
+// Every group owns bins_per_group consecutive bins: count_unique counts
+// the marked bins of each group, scan_offsets turns the counts into
+// result offsets, and scatter_unique writes the marked bins of each group
+// from its offset, so the result keeps the order of the bins.
+__kernel void count_unique(__global const int *histogram, int num_bins, int bins_per_group,
+						   __global int *group_counts, __local int *scratch)
+{
+	int i;
+	int lid = get_local_id(0);
+	int lsize = get_local_size(0);
+	int group = get_group_id(0);
+	int first = group * bins_per_group;
+	int last = first + min(num_bins - first, bins_per_group);
+	int count = 0;
+
+	for (i = first + lid; i < last; i += lsize)
+		count += histogram[i] == 1;
+	scan_group(count, scratch);
+	if (lid == 0)
+		group_counts[group] = scratch[lsize - 1];
+}
+
+// Run by a single work-group: exclusive scan of the group counts in place,
+// count receives their total
+__kernel void scan_offsets(__global int *group_counts, int num_groups, __global int *count,
+						   __local int *scratch)
+{
+	int first;
+	int lid = get_local_id(0);
+	int lsize = get_local_size(0);
+	int base = 0;
+
+	for (first = 0; first < num_groups; first += lsize)
+	{
+		int i = first + lid;
+		int value = i < num_groups ? group_counts[i] : 0;
+		int inclusive = scan_group(value, scratch);
+		if (i < num_groups)
+			group_counts[i] = base + inclusive - value;
+		base += scratch[lsize - 1];
+	}
+	if (lid == 0)
+		count[0] = base;
 }
 
-cl::Platform OCLWorker::SelectPlatform()
+// Writes bin i as keys[i], or as i + value_offset without keys
+void scatter_group(__global const int *histogram, __global const int *keys, int num_bins,
+				   int bins_per_group, __global const int *group_offsets, __global int *result,
+				   int value_offset, __local int *scratch)
 {
+	int chunk;
+	int lsize = get_local_size(0);
+	int group = get_group_id(0);
+	int first = group * bins_per_group;
+	int last = first + min(num_bins - first, bins_per_group);
+	int base = group_offsets[group];
+
+	for (chunk = first; chunk < last; chunk += lsize)
+	{
+		int i = chunk + get_local_id(0);
+		int flag = i < last && histogram[i] == 1;
+		int inclusive = scan_group(flag, scratch);
+		if (flag)
+			result[base + inclusive - 1] = keys != 0 ? keys[i] : as_int((uint)i + as_uint(value_offset));
+		base += scratch[lsize - 1];
+	}
+}
+
+__kernel void scatter_unique(__global const int *histogram, int num_bins, int bins_per_group,
+							 __global const int *group_offsets, __global int *result, int value_offset,
+							 __local int *scratch)
+{
+	scatter_group(histogram, 0, num_bins, bins_per_group, group_offsets, result, value_offset, scratch);
+}
+
+__kernel void scatter_unique_keys(__global const int *counts, __global const int *keys, int num_slots,
+								  int slots_per_group, __global const int *group_offsets,
+								  __global int *result, __local int *scratch)
+{
+	scatter_group(counts, keys, num_slots, slots_per_group, group_offsets, result, 0, scratch);
+}
+);
+// ---------------------------------- OpenCL ---------------------------------
+
+namespace
+{
+constexpr char BUILD_OPTIONS[] = "";
+constexpr size_t local_size = 256;
+constexpr size_t GROUPS_PER_UNIT = 4;
+// beyond this many tiles rescanning the data costs more than global atomics
+constexpr size_t MAX_LOCAL_TILES = 8;
+// local memory left to the runtime
+constexpr size_t LOCAL_MEM_RESERVE = 1024;
+// Auto takes the dense histogram up to this many bins per value, where it
+// is about as large as the hash table with its keys and counts at half load
+constexpr int64_t DENSE_BINS_PER_VALUE = 4;
+// and always up to this many bins
+constexpr int64_t DENSE_MIN_BINS = int64_t{1} << 16;
+// slots of the hash table must be addressable by a cl_int
+constexpr cl_int MAX_HASH_BITS = 30;
+// command queues that take turns with the chunks of a stream
+constexpr size_t STREAM_QUEUES = 2;
+
+std::optional<cl::Device> FindDevice(cl_device_type type)
+{
+	cl_uint numplatforms = 0;
+	if (::clGetPlatformIDs(0, NULL, &numplatforms) != CL_SUCCESS || numplatforms == 0)
+		return std::nullopt;
 	cl::vector<cl::Platform> platforms;
 	cl::Platform::get(&platforms);
 	for (auto p : platforms)
 	{
 		cl_uint numdevices = 0;
-		::clGetDeviceIDs(p(), CL_DEVICE_TYPE_GPU, 0, NULL, &numdevices);
+		::clGetDeviceIDs(p(), type, 0, NULL, &numdevices);
 		if (numdevices > 0)
-			return cl::Platform(p);
+		{
+			cl::vector<cl::Device> devices;
+			p.getDevices(type, &devices);
+			return devices.front();
+		}
 	}
-	throw std::runtime_error("No platform selected");
+	return std::nullopt;
 }
 
-cl::Context OCLWorker::GetGpuContext(cl_platform_id PId)
+// 64-bit FNV-1a, unlike std::hash stable across builds and runs
+uint64_t Fnv1a(const std::string& text)
 {
-	cl_context_properties properties[] = {
-		CL_CONTEXT_PLATFORM, reinterpret_cast<cl_context_properties>(PId),
-		0 // signals end of property list
-	};
-	return cl::Context(CL_DEVICE_TYPE_GPU, properties);
+	uint64_t hash = 14695981039346656037ull;
+	for (unsigned char c : text)
+		hash = (hash ^ c) * 1099511628211ull;
+	return hash;
 }
 
-namespace
+// A binary is only valid for the device, driver and source it was built from
+std::string CacheFileName(const cl::Device& device)
+{
+	cl::Platform platform(device.getInfo<CL_DEVICE_PLATFORM>());
+	std::string key = platform.getInfo<CL_PLATFORM_NAME>() + '\n' + platform.getInfo<CL_PLATFORM_VERSION>()
+		+ '\n' + device.getInfo<CL_DEVICE_NAME>() + '\n' + device.getInfo<CL_DEVICE_VERSION>()
+		+ '\n' + device.getInfo<CL_DRIVER_VERSION>() + '\n' + BUILD_OPTIONS + '\n' + findUniqueValues;
+	std::ostringstream name;
+	name << std::hex << std::setw(16) << std::setfill('0') << Fnv1a(key) << ".bin";
+	return name.str();
+}
+
+std::vector<unsigned char> ReadBinary(const std::filesystem::path& path)
 {
-template<typename It>
-cl::vector<cl_int> ConvertHistToResult(It first, It last)
+	std::ifstream input(path, std::ios::binary);
+	return std::vector<unsigned char>(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+}
+
+// The cache is best effort: a binary that cannot be stored is rebuilt next
+// time. Writing to a temporary file and renaming it keeps concurrent
+// workers from reading a partial binary.
+void WriteBinary(const std::filesystem::path& path, const std::vector<unsigned char>& binary)
 {
-	cl::vector<cl_int> result;
-	cl_int i = 0;
-	for (It it = first; it != last; ++it, ++i)
+	std::error_code error;
+	std::filesystem::create_directories(path.parent_path(), error);
+	auto temporary = path;
+	temporary += ".tmp" + std::to_string(std::random_device{}());
 	{
-		if (*it == 1)
-			result.push_back(i);
+		std::ofstream output(temporary, std::ios::binary);
+		output.write(reinterpret_cast<const char*>(binary.data()), binary.size());
+		if (!output)
+		{
+			output.close();
+			std::filesystem::remove(temporary, error);
+			return;
+		}
 	}
-	return result;
+	std::filesystem::rename(temporary, path, error);
+	if (error)
+		std::filesystem::remove(temporary, error);
 }
 }
 
-constexpr size_t local_size = 256;
+DeviceType ParseDeviceType(const std::string& name)
+{
+	if (name == "gpu")
+		return DeviceType::Gpu;
+	if (name == "cpu")
+		return DeviceType::Cpu;
+	if (name == "any")
+		return DeviceType::Any;
+	throw std::invalid_argument("Unknown device type " + name);
+}
+
+std::string DefaultCacheDir()
+{
+	if (const char* dir = std::getenv("UNIQUE_FINDER_CACHE"))
+		return dir;
+	std::error_code error;
+	auto temporary = std::filesystem::temp_directory_path(error);
+	return error ? std::string() : (temporary / "unique_finder").string();
+}
+
+OCLWorker::OCLWorker(DeviceType device_type, const std::string& cache_dir)
+	: device(SelectDevice(device_type))
+	, platform(device.getInfo<CL_DEVICE_PLATFORM>())
+	, context(device)
+	, command_queue(context, device)
+	, program(BuildProgram(context, device, cache_dir))
+	, histogram_global(program, "histogram_global")
+	, histogram_local(program, "histogram_local")
+	, hash_count(program, "hash_count")
+	, count_unique(program, "count_unique")
+	, scan_offsets(program, "scan_offsets")
+	, scatter_unique(program, "scatter_unique")
+	, scatter_unique_keys(program, "scatter_unique_keys")
+{
+	size_t kernel_limit = local_size;
+	for (const cl::Kernel& kernel : {histogram_global.getKernel(), histogram_local.getKernel(),
+									 hash_count.getKernel(), count_unique.getKernel(),
+									 scan_offsets.getKernel(), scatter_unique.getKernel(),
+									 scatter_unique_keys.getKernel()})
+		kernel_limit = std::min(kernel_limit, kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device));
+	work_group_size = kernel_limit;
+	work_groups = device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>() * GROUPS_PER_UNIT;
+	size_t local_memory = device.getInfo<CL_DEVICE_LOCAL_MEM_SIZE>();
+	local_bins = local_memory > LOCAL_MEM_RESERVE ? (local_memory - LOCAL_MEM_RESERVE) / sizeof(cl_int) : 0;
+	max_alloc = device.getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>();
+	unified_memory = device.getInfo<CL_DEVICE_HOST_UNIFIED_MEMORY>() != 0;
+	for (size_t i = 0; i < STREAM_QUEUES; ++i)
+		stream_queues.emplace_back(context, device);
+
+	cl::string name = platform.getInfo<CL_PLATFORM_NAME>();
+	cl::string profile = platform.getInfo<CL_PLATFORM_PROFILE>();
+	cl::string device_name = device.getInfo<CL_DEVICE_NAME>();
+	std::cout << "Selected: " << name << ": " << profile << ": " << device_name << std::endl;
+}
+
+cl::Device OCLWorker::SelectDevice(DeviceType device_type)
+{
+	std::optional<cl::Device> device;
+	switch (device_type)
+	{
+	case DeviceType::Gpu:
+		device = FindDevice(CL_DEVICE_TYPE_GPU);
+		break;
+	case DeviceType::Cpu:
+		device = FindDevice(CL_DEVICE_TYPE_CPU);
+		break;
+	case DeviceType::Any:
+		device = FindDevice(CL_DEVICE_TYPE_GPU);
+		if (!device)
+			device = FindDevice(CL_DEVICE_TYPE_ALL);
+		break;
+	}
+	if (!device)
+		throw NoDeviceError("No OpenCL device of the requested type");
+	return *device;
+}
+
+cl::Program OCLWorker::BuildProgram(const cl::Context& context, const cl::Device& device,
+									const std::string& cache_dir)
+{
+	std::filesystem::path path;
+	if (!cache_dir.empty())
+	{
+		path = std::filesystem::path(cache_dir) / CacheFileName(device);
+		auto binary = ReadBinary(path);
+		if (!binary.empty())
+		{
+			try
+			{
+				cl::Program program(context, {device}, cl::Program::Binaries{binary});
+				program.build({device}, BUILD_OPTIONS);
+				return program;
+			}
+			catch (cl::Error&)
+			{
+				// a stale or corrupt binary is rebuilt from the source
+			}
+		}
+	}
+
+	cl::Program program(context, findUniqueValues);
+	try
+	{
+		program.build({device}, BUILD_OPTIONS);
+	}
+	catch (cl::Error&)
+	{
+		throw std::runtime_error("OpenCL build failed: " + program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device));
+	}
+	if (!path.empty())
+	{
+		auto binaries = program.getInfo<CL_PROGRAM_BINARIES>();
+		if (!binaries.empty() && !binaries.front().empty())
+			WriteBinary(path, binaries.front());
+	}
+	return program;
+}
+
+cl::EnqueueArgs OCLWorker::StridedArgs(cl::CommandQueue& queue, const cl::vector<cl::Event>& events,
+									   cl_int data_size)
+{
+	// every work-item strides over the data, so the range needs not cover it
+	size_t groups = std::min(work_groups, (static_cast<size_t>(data_size) + work_group_size - 1) / work_group_size);
+	cl::NDRange GlobalRange(std::max<size_t>(groups, 1) * work_group_size);
+	cl::NDRange LocalRange(work_group_size);
+	return cl::EnqueueArgs(queue, events, GlobalRange, LocalRange);
+}
+
+cl::Event OCLWorker::EnqueueHistogram(cl::CommandQueue& queue, const cl::vector<cl::Event>& events,
+									   const cl::Buffer& data, cl_int data_size, const cl::Buffer& histogram,
+									   cl_int hist_size, cl_int min_value)
+{
+	cl::EnqueueArgs Args = StridedArgs(queue, events, data_size);
+	size_t tiles = local_bins != 0 ? (static_cast<size_t>(hist_size) + local_bins - 1) / local_bins : 0;
+	if (tiles == 0 || tiles > MAX_LOCAL_TILES)
+		return histogram_global(Args, data, data_size, histogram, hist_size, min_value);
+	cl::Event evt;
+	for (size_t tile = 0; tile < tiles; ++tile)
+	{
+		size_t offset = tile * local_bins;
+		size_t bins = std::min(local_bins, hist_size - offset);
+		evt = histogram_local(Args, data, data_size, histogram, static_cast<cl_int>(bins),
+							  static_cast<cl_int>(offset), min_value, cl::Local(bins * sizeof(cl_int)));
+	}
+	return evt;
+}
+
+cl::Event OCLWorker::EnqueueCompaction(const cl::vector<cl::Event>& events, const cl::Buffer& histogram,
+										cl_int hist_size, const cl::Buffer* keys, cl_int value_offset,
+										const cl::Buffer& result, const cl::Buffer& count)
+{
+	size_t bins = std::max<cl_int>(hist_size, 1);
+	size_t groups = std::min(work_groups, (bins + work_group_size - 1) / work_group_size);
+	size_t bins_per_group = (bins + groups - 1) / groups;
+	groups = (bins + bins_per_group - 1) / bins_per_group;
+	cl::Buffer GroupCounts(context, CL_MEM_READ_WRITE, groups * sizeof(cl_int));
+	cl::LocalSpaceArg scratch = cl::Local(work_group_size * sizeof(cl_int));
+
+	cl::NDRange GroupsRange(groups * work_group_size);
+	cl::NDRange LocalRange(work_group_size);
+	count_unique(cl::EnqueueArgs(command_queue, events, GroupsRange, LocalRange), histogram, hist_size,
+				 static_cast<cl_int>(bins_per_group), GroupCounts, scratch);
+	scan_offsets(cl::EnqueueArgs(command_queue, LocalRange, LocalRange), GroupCounts, static_cast<cl_int>(groups),
+				 count, scratch);
+	if (keys != nullptr)
+		return scatter_unique_keys(cl::EnqueueArgs(command_queue, GroupsRange, LocalRange), histogram, *keys,
+								   hist_size, static_cast<cl_int>(bins_per_group), GroupCounts, result, scratch);
+	return scatter_unique(cl::EnqueueArgs(command_queue, GroupsRange, LocalRange), histogram, hist_size,
+						  static_cast<cl_int>(bins_per_group), GroupCounts, result, value_offset, scratch);
+}
+
+size_t OCLWorker::ChunkSize(size_t chunk_size) const
+{
+	size_t limit = std::min<size_t>(max_alloc / sizeof(cl_int), INT_MAX);
+	return std::clamp<size_t>(chunk_size != 0 ? chunk_size : DEFAULT_CHUNK_SIZE, 1, limit);
+}
+
+cl::Event OCLWorker::StreamChunks(const cl_int* data, size_t data_size, size_t chunk_size, const cl::Event& start,
+								  const ChunkCounter& count)
+{
+	struct Slot
+	{
+		cl::CommandQueue* queue;
+		cl::Buffer device;
+		cl::Buffer pinned;
+		cl_int* host{nullptr};
+		cl::Event done;
+		bool busy{false};
+	};
+
+	chunk_size = ChunkSize(chunk_size);
+	size_t chunks = (data_size + chunk_size - 1) / chunk_size;
+	size_t chunk_bytes = std::min(chunk_size, data_size) * sizeof(cl_int);
+	std::vector<Slot> slots(std::min(stream_queues.size(), chunks));
+	for (size_t k = 0; k < slots.size(); ++k)
+	{
+		slots[k].queue = &stream_queues[k];
+		if (unified_memory)
+			continue;
+		slots[k].device = cl::Buffer(context, CL_MEM_READ_ONLY, chunk_bytes);
+		slots[k].pinned = cl::Buffer(context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, chunk_bytes);
+		slots[k].host = static_cast<cl_int*>(
+			slots[k].queue->enqueueMapBuffer(slots[k].pinned, CL_TRUE, CL_MAP_WRITE, 0, chunk_bytes));
+	}
+
+	cl::Event last = start;
+	for (size_t i = 0; i < chunks; ++i)
+	{
+		Slot& slot = slots[i % slots.size()];
+		size_t first = i * chunk_size;
+		size_t values = std::min(chunk_size, data_size - first);
+		cl::Buffer chunk;
+		if (unified_memory)
+		{
+			// the device reads the caller's memory in place
+			chunk = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, values * sizeof(cl_int),
+							   const_cast<cl_int*>(data + first));
+		}
+		else
+		{
+			// the slot is free once the kernels of its previous chunk are
+			if (slot.busy)
+				slot.done.wait();
+			std::copy_n(data + first, values, slot.host);
+			slot.queue->enqueueWriteBuffer(slot.device, CL_FALSE, 0, values * sizeof(cl_int), slot.host);
+			chunk = slot.device;
+		}
+		last = count(*slot.queue, {last}, chunk, static_cast<cl_int>(values));
+		slot.done = last;
+		slot.busy = true;
+		slot.queue->flush();
+	}
+	for (auto& slot : slots)
+	{
+		if (slot.host != nullptr)
+			slot.queue->enqueueUnmapMemObject(slot.pinned, slot.host);
+	}
+	return last;
+}
 
 std::pair<cl::vector<cl_int>, cl::vector<cl_int>>
-OCLWorker::SearchUnique(cl_int* data, cl_int data_size, cl_int hist_size)
+OCLWorker::SearchDense(const cl_int* data, size_t data_size, cl_int min_value, cl_int hist_size,
+					   bool return_histogram, size_t chunk_size)
 {
-	size_t buffer_size = data_size * sizeof(cl_int);
 	size_t buffer_result_size = hist_size * sizeof(cl_int);
+	cl::Buffer Hist(context, CL_MEM_READ_WRITE, buffer_result_size);
+	// there are no more unique values than bins or values
+	size_t max_unique = std::max<size_t>(std::min<size_t>(hist_size, data_size), 1);
+	cl::Buffer Res(context, CL_MEM_WRITE_ONLY, max_unique * sizeof(cl_int));
+	cl::Buffer Count(context, CL_MEM_READ_WRITE, sizeof(cl_int));
 
-	cl::Buffer Array(context, CL_MEM_READ_ONLY, buffer_size);
-	cl::Buffer Hist(context, CL_MEM_WRITE_ONLY, buffer_result_size);
-	//cl::Buffer Res(context, CL_MEM_WRITE_ONLY, buffer_result_size);
-	//cl::Buffer Count(context, CL_MEM_WRITE_ONLY, sizeof(cl_int));
+	cl::Event cleared;
+	command_queue.enqueueFillBuffer(Hist, cl_int{0}, 0, buffer_result_size, nullptr, &cleared);
+	cl::Event counted = StreamChunks(data, data_size, chunk_size, cleared,
+		[&](cl::CommandQueue& queue, const cl::vector<cl::Event>& events, const cl::Buffer& chunk, cl_int values)
+	{
+		return EnqueueHistogram(queue, events, chunk, values, Hist, hist_size, min_value);
+	});
+	cl::Event evt = EnqueueCompaction({counted}, Hist, hist_size, nullptr, min_value, Res, Count);
+	evt.wait();
 
-	cl::copy(command_queue, data, data + data_size, Array);
+	// only the count and the unique values cross the bus
+	cl_int count = 0;
+	cl::copy(command_queue, Count, &count, &count + 1);
+	cl::vector<cl_int> result(count);
+	if (count > 0)
+		cl::copy(command_queue, Res, result.data(), result.data() + result.size());
 
-	cl::Program program(context, findUniqueValues, true);
+	cl::vector<cl_int> hist;
+	if (return_histogram)
+	{
+		hist.resize(hist_size);
+		cl::copy(command_queue, Hist, hist.data(), hist.data() + hist.size());
+	}
+	return std::make_pair(result, hist);
+}
 
-	cl::KernelFunctor<cl::Buffer, cl_int, cl::Buffer, cl_int/*, cl::Buffer, cl::Buffer*/>
-	func(program, "histogram");
+cl::vector<cl_int> OCLWorker::SearchSparse(const cl_int* data, size_t data_size, int64_t range, size_t chunk_size)
+{
+	// at most half full for the distinct values there can be, so that probe
+	// sequences stay short, as far as the device allows
+	size_t distinct = std::min<uint64_t>(data_size, range);
+	cl_int bits = 1;
+	while ((size_t{1} << bits) < 2 * distinct && bits < MAX_HASH_BITS
+		   && (size_t{1} << (bits + 1)) * sizeof(cl_int) <= max_alloc)
+		++bits;
+	size_t slots = size_t{1} << bits;
 
-	cl::NDRange GlobalRange(data_size);
-	cl::NDRange LocalRange(local_size);
-	cl::EnqueueArgs Args(command_queue, GlobalRange, LocalRange);
+	cl::Buffer Keys(context, CL_MEM_READ_WRITE, slots * sizeof(cl_int));
+	cl::Buffer Counts(context, CL_MEM_READ_WRITE, slots * sizeof(cl_int));
+	cl::Buffer Res(context, CL_MEM_WRITE_ONLY, std::max<size_t>(std::min(distinct, slots), 1) * sizeof(cl_int));
+	cl::Buffer Count(context, CL_MEM_READ_WRITE, 3 * sizeof(cl_int));
 
-	cl::Event evt = func(Args, Array, data_size, Hist, hist_size/*, Res, Count*/);
+	cl::Event cleared;
+	command_queue.enqueueFillBuffer(Keys, cl_int{INT_MIN}, 0, slots * sizeof(cl_int));
+	command_queue.enqueueFillBuffer(Counts, cl_int{0}, 0, slots * sizeof(cl_int));
+	command_queue.enqueueFillBuffer(Count, cl_int{0}, 0, 3 * sizeof(cl_int), nullptr, &cleared);
+	cl::Event counted = StreamChunks(data, data_size, chunk_size, cleared,
+		[&](cl::CommandQueue& queue, const cl::vector<cl::Event>& events, const cl::Buffer& chunk, cl_int values)
+	{
+		return hash_count(StridedArgs(queue, events, values), chunk, values, Keys, Counts, bits, Count);
+	});
+	cl::Event evt = EnqueueCompaction({counted}, Counts, static_cast<cl_int>(slots), &Keys, 0, Res, Count);
 	evt.wait();
 
-//	cl_int count[1]{0};
-//	cl::copy(command_queue, Count, count, count + 1);
-//	std::cout << "COUNT: " << count[0] << std::endl;
+	cl_int count[3]{0, 0, 0};
+	cl::copy(command_queue, Count, count, count + 3);
+	if (count[2] != 0)
+		throw std::runtime_error("Too many distinct values for the device hash table");
+	cl::vector<cl_int> result(count[0]);
+	if (count[0] > 0)
+		cl::copy(command_queue, Res, result.data(), result.data() + result.size());
+	if (count[1] == 1)
+		result.push_back(INT_MIN);
+	// slots follow the hash, not the values
+	std::sort(result.begin(), result.end());
+	return result;
+}
+
+std::pair<cl::vector<cl_int>, cl::vector<cl_int>>
+OCLWorker::SearchUnique(cl_int* data, cl_int data_size, cl_int hist_size, bool return_histogram)
+{
+	return SearchDense(data, data_size, 0, hist_size, return_histogram, 0);
+}
 
-//	cl::vector<cl_int> result(count[0]);
-//	cl::copy(command_queue, Res, result.data(), result.data() + result.size());
+size_t OCLWorker::LocalBins() const
+{
+	return local_bins;
+}
 
-	cl::vector<cl_int> hist(hist_size);
-	cl::copy(command_queue, Hist, hist.data(), hist.data() + hist.size());
+cl::vector<cl_int> OCLWorker::FindUnique(const cl_int* data, size_t data_size, UniqueMode mode, size_t chunk_size)
+{
+	if (data_size == 0)
+		return {};
+	auto [lowest, highest] = std::minmax_element(data, data + data_size);
+	int64_t range = int64_t{*highest} - *lowest + 1;
+	bool dense_fits = range <= INT_MAX && static_cast<uint64_t>(range) * sizeof(cl_int) <= max_alloc;
+	if (mode == UniqueMode::Auto)
+	{
+		bool small = range <= std::max<int64_t>(DENSE_MIN_BINS, DENSE_BINS_PER_VALUE * data_size);
+		mode = dense_fits && small ? UniqueMode::Dense : UniqueMode::Sparse;
+	}
+	else if (mode == UniqueMode::Dense && !dense_fits)
+	{
+		throw std::invalid_argument("Value range too wide for a dense histogram");
+	}
 
-	auto result = ConvertHistToResult(hist.cbegin(), hist.cend());
-	return std::make_pair(result, hist);
+	if (mode == UniqueMode::Dense)
+		return SearchDense(data, data_size, *lowest, static_cast<cl_int>(range), false, chunk_size).first;
+	return SearchSparse(data, data_size, range, chunk_size);
 }
 
 
@@ -4,7 +4,10 @@
 #ifndef OCLWORKER_H
 #define OCLWORKER_H
 
+#include <functional>
 #include <iostream>
+#include <stdexcept>
+#include <string>
 
 #ifndef CL_HPP_TARGET_OPENCL_VERSION
 #define CL_HPP_MINIMUM_OPENCL_VERSION 120
@@ -15,21 +18,120 @@
 #define CL_HPP_ENABLE_EXCEPTIONS
 
 #include "CL/opencl.hpp"
+#include "uniquemode.h"
+
+enum class DeviceType
+{
+	Gpu,
+	Cpu,        // CPU runtimes such as PoCL
+	Any,        // a GPU when there is one, else any device
+};
+
+// No OpenCL device of the requested type, so callers can fall back to the
+// CPU apart from other failures
+class NoDeviceError : public std::runtime_error
+{
+public:
+	using std::runtime_error::runtime_error;
+};
+
+// "gpu", "cpu" or "any"; throws std::invalid_argument otherwise
+DeviceType ParseDeviceType(const std::string& name);
+
+// Directory of the program binary cache: $UNIQUE_FINDER_CACHE when set,
+// else unique_finder in the temporary directory
+std::string DefaultCacheDir();
+
+// Values per chunk when streaming the input to the device
+constexpr size_t DEFAULT_CHUNK_SIZE = size_t{1} << 22;
 
 class OCLWorker
 {
+	cl::Device device;
 	cl::Platform platform;
 	cl::Context context;
 	cl::CommandQueue command_queue;
+	cl::vector<cl::CommandQueue> stream_queues;     // chunks alternate between them
+	cl::Program program;
+	cl::KernelFunctor<cl::Buffer, cl_int, cl::Buffer, cl_int, cl_int> histogram_global;
+	cl::KernelFunctor<cl::Buffer, cl_int, cl::Buffer, cl_int, cl_int, cl_int, cl::LocalSpaceArg> histogram_local;
+	cl::KernelFunctor<cl::Buffer, cl_int, cl::Buffer, cl::Buffer, cl_int, cl::Buffer> hash_count;
+	cl::KernelFunctor<cl::Buffer, cl_int, cl_int, cl::Buffer, cl::LocalSpaceArg> count_unique;
+	cl::KernelFunctor<cl::Buffer, cl_int, cl::Buffer, cl::LocalSpaceArg> scan_offsets;
+	cl::KernelFunctor<cl::Buffer, cl_int, cl_int, cl::Buffer, cl::Buffer, cl_int, cl::LocalSpaceArg> scatter_unique;
+	cl::KernelFunctor<cl::Buffer, cl::Buffer, cl_int, cl_int, cl::Buffer, cl::Buffer, cl::LocalSpaceArg>
+	scatter_unique_keys;
+	size_t work_group_size;
+	size_t work_groups;         // enough groups to fill the device, each loops over its share
+	size_t local_bins;          // bins of one histogram_local tile
+	size_t max_alloc;           // largest buffer of the device
+	bool unified_memory;        // the device reads host memory without a copy
+
+	static cl::Device SelectDevice(DeviceType device_type);
+	// Builds the kernels for the device, from a cached binary when the
+	// cache has one for this device and source, and stores new binaries
+	// there; an empty cache_dir disables the cache
+	static cl::Program BuildProgram(const cl::Context& context, const cl::Device& device,
+									const std::string& cache_dir);
+
+	// Launch over data_size values for the kernels that stride over them
+	cl::EnqueueArgs StridedArgs(cl::CommandQueue& queue, const cl::vector<cl::Event>& events, cl_int data_size);
+	// Counts data minus min_value into histogram, which must be zeroed: in
+	// local memory tiles of local_bins bins while there are at most
+	// MAX_LOCAL_TILES of them, otherwise with global atomics. Returns the
+	// last launch.
+	cl::Event EnqueueHistogram(cl::CommandQueue& queue, const cl::vector<cl::Event>& events,
+							   const cl::Buffer& data, cl_int data_size, const cl::Buffer& histogram,
+							   cl_int hist_size, cl_int min_value);
+	// Writes the bins of histogram that hold 1 to result in the order of
+	// the bins, as keys[bin] with keys or else as bin + value_offset, and
+	// their number to count[0]. Returns the last launch.
+	cl::Event EnqueueCompaction(const cl::vector<cl::Event>& events, const cl::Buffer& histogram,
+								cl_int hist_size, const cl::Buffer* keys, cl_int value_offset,
+								const cl::Buffer& result, const cl::Buffer& count);
 
-	static cl::Platform SelectPlatform();
-	static cl::Context GetGpuContext(cl_platform_id);
+	// Enqueues the counting of one chunk on the queue after the events and
+	// returns its last launch
+	using ChunkCounter = std::function<cl::Event(cl::CommandQueue& queue, const cl::vector<cl::Event>& events,
+												 const cl::Buffer& chunk, cl_int values)>;
+	size_t ChunkSize(size_t chunk_size) const;
+	// Feeds data to count in chunks of chunk_size values, taking turns over
+	// stream_queues, so that the upload of one chunk overlaps the kernels
+	// of the previous one; the counting itself stays in order, every chunk
+	// waits for the last. A device with unified memory reads the chunks in
+	// place, others get them through pinned staging buffers, one per queue.
+	// Returns the last launch.
+	cl::Event StreamChunks(const cl_int* data, size_t data_size, size_t chunk_size, const cl::Event& start,
+						   const ChunkCounter& count);
+
+	std::pair<cl::vector<cl_int>, cl::vector<cl_int>>
+	SearchDense(const cl_int* data, size_t data_size, cl_int min_value, cl_int hist_size,
+				bool return_histogram, size_t chunk_size);
+	cl::vector<cl_int> SearchSparse(const cl_int* data, size_t data_size, int64_t range, size_t chunk_size);
 
 public:
-	OCLWorker();
+	// Throws NoDeviceError when no device of the type exists
+	explicit OCLWorker(DeviceType device_type = DeviceType::Any, const std::string& cache_dir = DefaultCacheDir());
 
+	// Values of data in [0, hist_size) that occur exactly once, in ascending
+	// order, and the histogram, which stays empty unless return_histogram.
+	// Values outside the histogram are skipped.
 	std::pair<cl::vector<cl_int>, cl::vector<cl_int>>
-	SearchUnique(cl_int* data, cl_int data_size, cl_int hist_size);
+	SearchUnique(cl_int* data, cl_int data_size, cl_int hist_size, bool return_histogram = true);
+
+	// Values of data that occur exactly once, in ascending order, over the
+	// whole int range. The data is streamed in chunks of chunk_size values,
+	// 0 for DEFAULT_CHUNK_SIZE, so it may exceed device memory; only the
+	// histogram or hash table stays on the device. Throws
+	// std::invalid_argument when Dense is asked for a range the device
+	// cannot hold and std::runtime_error when the distinct values overflow
+	// the hash table of Sparse.
+	cl::vector<cl_int> FindUnique(const cl_int* data, size_t data_size, UniqueMode mode = UniqueMode::Auto,
+								  size_t chunk_size = 0);
+
+	// Bins of one local memory tile; histograms of a few tiles are counted
+	// tile by tile in local memory, larger ones with global atomics
+	size_t LocalBins() const;
 
 };
 
@@ -0,0 +1,15 @@
+// Source code for Test task
+// Licensed after GNU GPL v3
+
+#ifndef UNIQUEMODE_H
+#define UNIQUEMODE_H
+
+// How FindUnique counts the values, on the device or on the CPU
+enum class UniqueMode
+{
+	Auto,       // Dense when the value range is small against the data
+	Dense,      // counters over [min, max] of the data
+	Sparse,     // the distinct values alone: a device hash table, radix partitions on the CPU
+};
+
+#endif // UNIQUEMODE_H